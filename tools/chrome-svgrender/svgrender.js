@@ -1,20 +1,25 @@
 'use strict';
 
 const puppeteer = require('puppeteer');
+const fs = require('fs');
+const os = require('os');
 const path = require('path');
+const readline = require('readline');
 
-var argv = process.argv.slice(2);
-var svg_path = path.resolve(argv[0]);
-var png_path = argv[1];
-
-(async() => {
-
-try {
-    const browser = await puppeteer.launch({
+function launchBrowser() {
+    return puppeteer.launch({
         headless: "new",
         args: ['--no-sandbox', '--disable-setuid-sandbox']
     });
-    const page = await browser.newPage();
+}
+
+// Renders an SVG into a PNG using an existing page.
+// `width` is a string or undefined. Throws on error.
+async function renderPage(page, svg_path, png_path, width) {
+    // parseInt() would turn garbage into NaN and a zero-size viewport.
+    if (width != undefined && !/^[1-9][0-9]*$/.test(width)) {
+        throw new Error("invalid width: " + width)
+    }
 
     await page.goto("file://" + svg_path);
 
@@ -31,11 +36,10 @@ try {
 
     if (is_dynamic) {
         var svg_width;
-        if (argv[2] == undefined) {
-            console.log("Error: width argument must be set")
-            process.exit()
+        if (width == undefined) {
+            throw new Error("width argument must be set")
         } else {
-            svg_width = parseInt(argv[2])
+            svg_width = parseInt(width)
         }
 
         var svg_view_box = await page.evaluate(() => {
@@ -48,8 +52,7 @@ try {
         });
 
         if (svg_view_box == null) {
-            console.error("Error: no viewBox")
-            process.exit(1);
+            throw new Error("no viewBox")
         }
 
         var view_size;
@@ -59,9 +62,11 @@ try {
             view_size = [svg_view_box[2], svg_view_box[3]]
         }
 
+        // A pooled page could have a scale factor left from a previous file.
         await page.setViewport({
             width: parseInt(view_size[0]),
-            height: parseInt(view_size[1])
+            height: parseInt(view_size[1]),
+            deviceScaleFactor: 1
         });
 
         var y = 0;
@@ -91,8 +96,8 @@ try {
         });
 
         var svg_scale = 1
-        if (argv[2] != undefined) {
-            svg_scale = argv[2] / svg_rect[2]
+        if (width != undefined) {
+            svg_scale = width / svg_rect[2]
         }
 
         await page.setViewport({
@@ -107,11 +112,96 @@ try {
             omitBackground: true
         });
     }
+}
 
+// Jobs are `in.svg<TAB>out.png[<TAB>width]` lines from a file or stdin.
+async function readJobs(list_path) {
+    const input = list_path == "-" ? process.stdin : fs.createReadStream(list_path);
+    const lines = readline.createInterface({ input: input, crlfDelay: Infinity });
+
+    var jobs = [];
+    for await (const line of lines) {
+        if (line.trim() == "") {
+            continue
+        }
+
+        const items = line.split('\t');
+        jobs.push({
+            svg_path: path.resolve(items[0]),
+            png_path: items[1],
+            width: items[2] == "" ? undefined : items[2]
+        });
+    }
+
+    return jobs;
+}
+
+// One browser and `pages_count` pages, each taking the next job once it's done.
+// Prints `OK<TAB>out.png<TAB>ms` or `ERROR<TAB>in.svg<TAB>message` for each job.
+async function renderBatch(list_path, pages_count) {
+    const jobs = await readJobs(list_path);
+    const browser = await launchBrowser();
+
+    var next = 0;
+    var errors = 0;
+    const worker = async () => {
+        const page = await browser.newPage();
+        while (next < jobs.length) {
+            const job = jobs[next++];
+            const started = Date.now();
+            try {
+                if (job.png_path == undefined) {
+                    throw new Error("invalid job")
+                }
+
+                await renderPage(page, job.svg_path, job.png_path, job.width);
+                console.log("OK\t" + job.png_path + "\t" + (Date.now() - started))
+            } catch (e) {
+                errors++;
+                console.log("ERROR\t" + job.svg_path + "\t" + e.message)
+            }
+        }
+        await page.close();
+    };
+
+    var workers = [];
+    for (var i = 0; i < Math.min(pages_count, jobs.length); i++) {
+        workers.push(worker());
+    }
+    await Promise.all(workers);
+
+    await browser.close();
+    return errors;
+}
+
+(async() => {
+
+var argv = process.argv.slice(2);
+
+try {
+    if (argv[0] == "--batch") {
+        if (argv[1] == undefined) {
+            console.log("Error: a jobs list must be set")
+            process.exit(1)
+        }
+
+        var pages_count = argv[2] == undefined ? os.cpus().length : Number(argv[2]);
+        if (!Number.isInteger(pages_count) || pages_count <= 0) {
+            console.log("Error: invalid pages count: " + argv[2])
+            process.exit(1)
+        }
+
+        const errors = await renderBatch(argv[1], pages_count);
+        process.exit(errors == 0 ? 0 : 2)
+    }
+
+    const browser = await launchBrowser();
+    const page = await browser.newPage();
+    await renderPage(page, path.resolve(argv[0]), argv[1], argv[2]);
     browser.close();
 
 } catch (e) {
-    console.log(e)
+    console.log("Error: " + e.message)
     process.exit(1)
 }
 
@@ -0,0 +1,393 @@
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+
+#include "paths.h"
+#include "process.h"
+#include "render.h"
+#include "renderhistory.h"
+#include "renderserver.h"
+#include "settings.h"
+#include "testindex.h"
+
+struct Options
+{
+    QVector<Backend> backends;
+    QStringList groups;
+    int viewSize = 0;
+    int warmup = 10;
+    int repeat = 5;
+    bool useServer = true;
+};
+
+struct Sample
+{
+    double latency; // ms, of the kept repetitions
+    qint64 cpuTime; // us, -1 when unknown
+    qint64 peakRss; // KiB, -1 when unknown
+    int rejected;
+};
+
+struct GroupResult
+{
+    QVector<Sample> samples;
+    int errors = 0;
+};
+
+static QString converterPath(const Settings &settings, const Backend backend)
+{
+    switch (backend) {
+        case Backend::Batik         : return settings.batikPath;
+        case Backend::JSVG          : return settings.jsvgPath;
+        case Backend::SVGSalamander : return settings.svgsalamanderPath;
+        case Backend::EchoSVG       : return settings.echosvgPath;
+        default : return QString();
+    }
+}
+
+static QString javaVersion()
+{
+    try {
+        const auto output = Process::run("java", { "-version" }, true);
+        return QString::fromUtf8(output).section('\n', 0, 0).trimmed();
+    } catch (const QString &) {
+        return QString();
+    }
+}
+
+// Sorted, so runs are comparable.
+static QStringList collectTests(const QString &dir)
+{
+    QStringList files;
+    QDirIterator it(dir, { "*.svg" }, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        files << it.next();
+    }
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static RenderData makeJob(Settings settings, const Backend backend, const QString &path,
+                          const int viewSize, const bool useServer)
+{
+    settings.useBatik = backend == Backend::Batik;
+    settings.useJSVG = backend == Backend::JSVG;
+    settings.useSVGSalamander = backend == Backend::SVGSalamander;
+    settings.useEchoSVG = backend == Backend::EchoSVG;
+
+    for (auto data : Render::prepareJobs(settings, path, viewSize)) {
+        if (data.type == backend) {
+            data.useServer = useServer;
+            data.useCache = false;
+            return data;
+        }
+    }
+
+    throw QString("No render job for %1.").arg(backendToString(backend));
+}
+
+static double median(QVector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const int n = values.size();
+    return n % 2 == 1 ? values.at(n / 2) : (values.at(n / 2 - 1) + values.at(n / 2)) / 2;
+}
+
+// Nearest-rank percentile of sorted values.
+static double percentile(const QVector<double> &sorted, const double p)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+
+    const int rank = qBound(1, int(std::ceil(p / 100.0 * sorted.size())), sorted.size());
+    return sorted.at(rank - 1);
+}
+
+// Renders a test `repeat` times and drops repetitions further than
+// 3 scaled median absolute deviations from the median, like a GC pause or a page cache miss.
+static bool measure(const RenderData &data, const int repeat, Sample *sample)
+{
+    QVector<double> latencies;
+    qint64 cpuTime = -1;
+    qint64 peakRss = -1;
+    for (int i = 0; i < repeat; ++i) {
+        const auto res = Render::renderImage(data);
+        if (!res.error.isEmpty()) {
+            qWarning().noquote() << res.error;
+            return false;
+        }
+
+        latencies << res.stats.wallTime() / 1000.0;
+        cpuTime = qMax(cpuTime, res.stats.cpuTime);
+        peakRss = qMax(peakRss, res.stats.peakRss);
+    }
+
+    const double med = median(latencies);
+
+    QVector<double> deviations;
+    for (const auto v : latencies) {
+        deviations << std::abs(v - med);
+    }
+    const double limit = 3 * 1.4826 * median(deviations);
+
+    double sum = 0;
+    int kept = 0;
+    for (const auto v : latencies) {
+        if (limit == 0 || std::abs(v - med) <= limit) {
+            sum += v;
+            kept++;
+        }
+    }
+
+    *sample = { sum / kept, cpuTime, peakRss, repeat - kept };
+    return true;
+}
+
+static QJsonObject summarize(const GroupResult &result)
+{
+    QVector<double> latencies;
+    double totalTime = 0;
+    double cpuTime = 0;
+    qint64 peakRss = -1;
+    int rejected = 0;
+    for (const auto &sample : result.samples) {
+        latencies << sample.latency;
+        totalTime += sample.latency;
+        cpuTime += qMax<qint64>(0, sample.cpuTime) / 1000.0;
+        peakRss = qMax(peakRss, sample.peakRss);
+        rejected += sample.rejected;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    QJsonObject latency;
+    latency.insert("mean", latencies.isEmpty() ? 0.0 : totalTime / latencies.size());
+    latency.insert("p50", percentile(latencies, 50));
+    latency.insert("p90", percentile(latencies, 90));
+    latency.insert("p99", percentile(latencies, 99));
+    latency.insert("max", latencies.isEmpty() ? 0.0 : latencies.last());
+
+    QJsonObject obj;
+    obj.insert("tests", result.samples.size());
+    obj.insert("errors", result.errors);
+    obj.insert("rejected_repetitions", rejected);
+    obj.insert("throughput", totalTime == 0 ? 0.0 : result.samples.size() / (totalTime / 1000));
+    obj.insert("latency_ms", latency);
+    obj.insert("cpu_ms", cpuTime);
+    obj.insert("peak_rss_kib", peakRss);
+    return obj;
+}
+
+static QJsonObject runBackend(const Settings &settings, const Options &opt, const Backend backend)
+{
+    const auto convPath = converterPath(settings, backend);
+    const auto testsDir = QDir(settings.testsPath());
+
+    QJsonObject groups;
+    GroupResult total;
+    for (const auto &group : opt.groups) {
+        const auto files = collectTests(testsDir.filePath(group));
+        if (files.isEmpty()) {
+            continue;
+        }
+
+        // Lets the JIT, the server and the page cache settle.
+        for (int i = 0; i < opt.warmup; ++i) {
+            const auto &path = files.at(i % files.size());
+            Render::renderImage(makeJob(settings, backend, path, opt.viewSize, opt.useServer));
+        }
+
+        GroupResult result;
+        for (const auto &path : files) {
+            Sample sample;
+            const auto data = makeJob(settings, backend, path, opt.viewSize, opt.useServer);
+            if (measure(data, opt.repeat, &sample)) {
+                result.samples << sample;
+            } else {
+                result.errors++;
+            }
+        }
+
+        qInfo().noquote() << QString("%1 %2: %3 tests")
+                             .arg(backendToString(backend), group).arg(files.size());
+
+        groups.insert(group, summarize(result));
+        total.samples << result.samples;
+        total.errors += result.errors;
+    }
+
+    QJsonObject obj;
+    obj.insert("converter", QFileInfo(convPath).fileName());
+    obj.insert("converter_sha1", QString(Paths::fileHash(convPath).toHex()));
+    obj.insert("groups", groups);
+    obj.insert("total", summarize(total));
+    return obj;
+}
+
+// In the format of `chart.json` produced by `stats.py`.
+static QJsonObject makeChart(const QJsonObject &backends)
+{
+    QJsonArray items;
+    for (auto it = backends.constBegin(); it != backends.constEnd(); ++it) {
+        const auto total = it.value().toObject().value("total").toObject();
+
+        QJsonObject item;
+        item.insert("name", it.key());
+        item.insert("value", std::round(total.value("throughput").toDouble() * 10) / 10);
+        item.insert("crashed", total.value("errors").toInt());
+        items.append(item);
+    }
+
+    QJsonObject font;
+    font.insert("family", "Arial");
+    font.insert("size", 12);
+
+    QJsonObject axis;
+    axis.insert("title", "Tests per second");
+    axis.insert("round_tick_values", true);
+    axis.insert("width", 700);
+
+    QJsonObject chart;
+    chart.insert("items_font", font);
+    chart.insert("items", items);
+    chart.insert("hor_axis", axis);
+    return chart;
+}
+
+static bool writeJson(const QString &path, const QJsonObject &obj)
+{
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        qCritical().noquote() << QString("Failed to open %1.").arg(path);
+        return false;
+    }
+
+    file.write(QJsonDocument(obj).toJson());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // Errors are drawn into images, which requires fonts, but not a display.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication a(argc, argv);
+    // Use the converters configured in vdiff.
+    a.setOrganizationName("vector");
+    a.setApplicationName("vdiff");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the render throughput of the vdiff backends.");
+    parser.addHelpOption();
+
+    const QCommandLineOption outOpt(QStringList({ "o", "output" }),
+                                    "Path to the results.", "file", "perf.json");
+    const QCommandLineOption chartOpt("chart", "Path to a chart data for `barh`.", "file");
+    const QCommandLineOption backendOpt("backend",
+                                        "Measure only the specified backend. Can be repeated.",
+                                        "name");
+    const QCommandLineOption groupOpt("group",
+                                      "Measure only the specified tests group. Can be repeated.",
+                                      "name");
+    const QCommandLineOption viewSizeOpt("view-size", "Image width in pixels.", "px");
+    const QCommandLineOption warmupOpt("warmup", "Renders before measuring each group.", "n", "10");
+    const QCommandLineOption repeatOpt("repeat", "Renders of each test.", "n", "5");
+    const QCommandLineOption noServerOpt("no-server", "Start a new JVM for each render.");
+    parser.addOptions({ outOpt, chartOpt, backendOpt, groupOpt, viewSizeOpt, warmupOpt, repeatOpt,
+                        noServerOpt });
+    parser.process(a);
+
+    Settings settings;
+    settings.load();
+
+    Options opt;
+    opt.viewSize = parser.isSet(viewSizeOpt) ? parser.value(viewSizeOpt).toInt()
+                                             : settings.viewSize;
+    opt.warmup = qMax(0, parser.value(warmupOpt).toInt());
+    opt.repeat = qMax(1, parser.value(repeatOpt).toInt());
+    opt.useServer = !parser.isSet(noServerOpt);
+    opt.groups = parser.values(groupOpt);
+
+    if (opt.groups.isEmpty()) {
+        opt.groups = QDir(settings.testsPath()).entryList(QDir::Dirs | QDir::NoDotAndDotDot,
+                                                          QDir::Name);
+    }
+
+    for (const auto &name : parser.values(backendOpt)) {
+        bool isFound = false;
+        for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+            if (backendToString((Backend)t).compare(name, Qt::CaseInsensitive) == 0) {
+                opt.backends << (Backend)t;
+                isFound = true;
+            }
+        }
+
+        if (!isFound) {
+            qCritical().noquote() << QString("Unknown backend: %1").arg(name);
+            return 1;
+        }
+    }
+
+    if (opt.backends.isEmpty()) {
+        for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+            if (!converterPath(settings, (Backend)t).isEmpty()) {
+                opt.backends << (Backend)t;
+            }
+        }
+    }
+
+    QJsonObject backends;
+    try {
+        for (const auto backend : opt.backends) {
+            backends.insert(backendToString(backend), runBackend(settings, opt, backend));
+        }
+    } catch (const QString &msg) {
+        qCritical().noquote() << msg;
+        RenderServer::shutdown();
+        return 1;
+    }
+
+    RenderServer::shutdown();
+    RenderHistory::save();
+    TestIndex::save();
+
+    QJsonObject machine;
+    machine.insert("os", QSysInfo::prettyProductName());
+    machine.insert("cpu_arch", QSysInfo::currentCpuArchitecture());
+    machine.insert("cores", QThread::idealThreadCount());
+    machine.insert("java", javaVersion());
+
+    QJsonObject root;
+    root.insert("view_size", opt.viewSize);
+    root.insert("warmup", opt.warmup);
+    root.insert("repeat", opt.repeat);
+    root.insert("render_server", opt.useServer);
+    root.insert("machine", machine);
+    root.insert("backends", backends);
+
+    if (!writeJson(parser.value(outOpt), root)) {
+        return 1;
+    }
+
+    if (parser.isSet(chartOpt) && !writeJson(parser.value(chartOpt), makeChart(backends))) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+QT = core gui concurrent network sql
+
+TARGET = perf
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# Renders exactly like vdiff does.
+VDIFF = $$PWD/../vdiff
+
+INCLUDEPATH += $$VDIFF/src
+
+SOURCES += \
+    main.cpp \
+    $$VDIFF/src/classifier.cpp \
+    $$VDIFF/src/diffkernel.cpp \
+    $$VDIFF/src/imagepool.cpp \
+    $$VDIFF/src/jobstats.cpp \
+    $$VDIFF/src/paths.cpp \
+    $$VDIFF/src/process.cpp \
+    $$VDIFF/src/referencestore.cpp \
+    $$VDIFF/src/render.cpp \
+    $$VDIFF/src/rendercache.cpp \
+    $$VDIFF/src/renderhistory.cpp \
+    $$VDIFF/src/renderserver.cpp \
+    $$VDIFF/src/resultsstore.cpp \
+    $$VDIFF/src/scheduler.cpp \
+    $$VDIFF/src/settings.cpp \
+    $$VDIFF/src/testindex.cpp \
+    $$VDIFF/src/tests.cpp
+
+HEADERS += \
+    $$VDIFF/src/render.h
+
+DEFINES += SRCDIR=\\\"$$VDIFF/\\\"
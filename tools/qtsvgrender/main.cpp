@@ -1,16 +1,134 @@
+#include <QElapsedTimer>
 #include <QGuiApplication>
 #include <QSvgRenderer>
 #include <QPainter>
 #include <QFile>
+#include <QTextStream>
 
 #include <cmath>
+#include <cstdio>
+
+// Returns an error message or an empty string.
+static QString render(const QByteArray &svgData, const QString &outPath, const int width)
+{
+    QSvgRenderer render(svgData);
+
+    if (!render.isValid()) {
+        return "Invalid SVG data.";
+    }
+
+    QSize imgSize = render.viewBox().size();
+
+    // Scale to width.
+    if (width != 0) {
+        imgSize.setHeight(std::ceil(double(width) * imgSize.height() / imgSize.width()));
+        imgSize.setWidth(width);
+    }
+
+    QImage img(imgSize, QImage::Format_ARGB32);
+    img.fill(Qt::transparent);
+
+    QPainter p(&img);
+    render.render(&p);
+    p.end();
+
+    if (!img.save(outPath)) {
+        return "Failed to write an output file.";
+    }
+
+    return QString();
+}
+
+// Renders jobs from a manifest or stdin, one `in.svg<TAB>out.png[<TAB>width]` per line,
+// and prints `OK<TAB>out.png<TAB>ms` or `ERROR<TAB>in.svg<TAB>message` for each of them
+// as soon as it's done.
+//
+// A single QGuiApplication and its font database are shared by all jobs,
+// while each of them gets a new QSvgRenderer.
+static int runBatch(int argc, char *argv[], const QString &manifest)
+{
+    // Text rendering requires fonts, but not a display.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+
+    QFile input;
+    bool isOpened = false;
+    if (manifest == "-") {
+        isOpened = input.open(stdin, QFile::ReadOnly);
+    } else {
+        input.setFileName(manifest);
+        isOpened = input.open(QFile::ReadOnly);
+    }
+
+    if (!isOpened) {
+        printf("Error: Failed to open a manifest.\n");
+        return 1;
+    }
+
+    QTextStream in(&input);
+    QTextStream out(stdout);
+
+    int errors = 0;
+    QString line;
+    while (in.readLineInto(&line)) {
+        if (line.trimmed().isEmpty()) {
+            continue;
+        }
+
+        const auto items = line.split('\t');
+        if (items.size() < 2) {
+            out << "ERROR\t" << line << "\tInvalid job.\n";
+            out.flush();
+            errors++;
+            continue;
+        }
+
+        const auto &inPath = items.at(0);
+        const auto &outPath = items.at(1);
+        const int width = items.size() > 2 ? items.at(2).toInt() : 0;
+
+        QElapsedTimer timer;
+        timer.start();
+
+        QString error;
+        QFile file(inPath);
+        if (file.open(QFile::ReadOnly)) {
+            error = render(file.readAll(), outPath, width);
+        } else {
+            error = "Failed to open an input file.";
+        }
+
+        if (error.isEmpty()) {
+            out << "OK\t" << outPath << '\t' << timer.elapsed() << '\n';
+        } else {
+            out << "ERROR\t" << inPath << '\t' << error << '\n';
+            errors++;
+        }
+
+        // The caller can start using a result right away.
+        out.flush();
+    }
+
+    return errors == 0 ? 0 : 2;
+}
 
 int main(int argc, char *argv[])
 {
+    if (argc == 3 && QByteArray(argv[1]) == "--batch") {
+        return runBatch(argc, argv, QString::fromLocal8Bit(argv[2]));
+    }
+
     if (!(argc == 3 || argc == 4)) {
         printf("Usage:\n"
                "  qtsvgrender in.svg out.png\n"
-               "  qtsvgrender in.svg out.png 500\n");
+               "  qtsvgrender in.svg out.png 500\n"
+               "  qtsvgrender --batch jobs.txt\n"
+               "  qtsvgrender --batch - < jobs.txt\n"
+               "\n"
+               "Each line of a batch is `in.svg<TAB>out.png[<TAB>width]`.\n");
         return 1;
     }
 
@@ -25,36 +143,16 @@ int main(int argc, char *argv[])
     const bool isGuiRequired = svgData.contains("<text");
 
     // QGuiApplication initialization is very slow and only needed to render text,
-    // so avoid it if possible.
+    // so avoid it if possible. Use `--batch` to render many files.
     QScopedPointer<QCoreApplication> app(isGuiRequired ? new QGuiApplication(argc, argv)
                                                        : new QCoreApplication(argc, argv));
 
-    QSvgRenderer render(svgData);
-
-    if (!render.isValid()) {
-        printf("Error: Invalid SVG data.\n");
+    const int width = argc == 4 ? QString(argv[3]).toUInt() : 0;
+    const auto error = render(svgData, argv[2], width);
+    if (!error.isEmpty()) {
+        printf("Error: %s\n", qPrintable(error));
         return 1;
     }
 
-    QSize imgSize = render.viewBox().size();
-
-    // Scale to width.
-    if (argc == 4) {
-        const int w = QString(argv[3]).toUInt();
-        if (w != 0) {
-            imgSize.setHeight(std::ceil(double(w) * imgSize.height() / imgSize.width()));
-            imgSize.setWidth(w);
-        }
-    }
-
-    QImage img(imgSize, QImage::Format_ARGB32);
-    img.fill(Qt::transparent);
-
-    QPainter p(&img);
-    render.render(&p);
-    p.end();
-
-    img.save(argv[2]);
-
     return 0;
 }
@@ -0,0 +1,399 @@
+// A long-lived JVM that runs converter jobs for vdiff.
+//
+// Starting a new JVM per image is far slower than the render itself, so vdiff
+// starts this server once per converter jar and sends it jobs over a local socket.
+//
+// Runs directly from source (Java 11+), so no build step is required:
+//
+//   java -Djava.awt.headless=true RenderServer.java converter.jar port-file parent-pid
+//
+// The server loads `Main-Class` of the converter jar and, for every connection,
+// reads a single line with the converter arguments separated by tabs and calls `main` with them.
+// The last argument is the output PNG path.
+//
+// Instead of going through that file, the rendered image is sent back over the same connection
+// as `IMAGE<tab>width<tab>height<tab>cpu-us` followed by raw little-endian ARGB32 pixels.
+// The CPU time is of the job's thread, -1 when unknown. The peak RSS is not reported,
+// since the JVM's one is shared by all jobs and never goes down.
+// PNG encoding via ImageIO is skipped altogether: a PNG writer registered ahead of the default one
+// captures the image instead. Converters that use their own encoder still work,
+// the output file is decoded by the server in that case. Errors are reported as `ERROR<tab>message`.
+//
+// Converter mains often call `System.exit`, even on success. On Java 11-17 it's trapped
+// for job threads by a security manager and a non-zero status is reported as an error.
+// When a security manager can't be installed, jobs are run one at a time instead,
+// so an exit only takes down the job that called it.
+//
+// If a job brings down the JVM anyway, the connection is closed without a reply
+// and vdiff restarts the server.
+
+import java.awt.Graphics2D;
+import java.awt.geom.AffineTransform;
+import java.awt.image.BufferedImage;
+import java.awt.image.RenderedImage;
+import java.io.BufferedOutputStream;
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.io.OutputStream;
+import java.lang.management.ManagementFactory;
+import java.lang.management.ThreadMXBean;
+import java.lang.reflect.InvocationTargetException;
+import java.lang.reflect.Method;
+import java.net.InetAddress;
+import java.net.ServerSocket;
+import java.net.Socket;
+import java.net.URL;
+import java.net.URLClassLoader;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardCopyOption;
+import java.security.Permission;
+import java.util.Iterator;
+import java.util.Locale;
+import java.util.concurrent.locks.ReentrantLock;
+import java.util.jar.Attributes;
+import java.util.jar.JarFile;
+
+import javax.imageio.IIOImage;
+import javax.imageio.ImageIO;
+import javax.imageio.ImageTypeSpecifier;
+import javax.imageio.ImageWriteParam;
+import javax.imageio.ImageWriter;
+import javax.imageio.metadata.IIOMetadata;
+import javax.imageio.spi.IIORegistry;
+import javax.imageio.spi.ImageWriterSpi;
+
+public class RenderServer {
+    // Set while a job is running on the current thread.
+    private static final ThreadLocal<Boolean> CAPTURING = new ThreadLocal<>();
+    private static final ThreadLocal<RenderedImage> CAPTURED = new ThreadLocal<>();
+
+    // Held by every job when `System.exit` can't be trapped.
+    private static ReentrantLock jobLock;
+
+    public static void main(String[] args) throws Exception {
+        if (args.length != 3) {
+            System.err.println("Usage: RenderServer converter.jar port-file parent-pid");
+            System.exit(1);
+        }
+
+        final Method entry = loadEntryPoint(new File(args[0]));
+        registerCaptureWriter();
+        if (!trapExit()) {
+            jobLock = new ReentrantLock();
+        }
+
+        // Do not outlive vdiff.
+        final long parentPid = Long.parseLong(args[2]);
+        ProcessHandle.of(parentPid).ifPresentOrElse(
+            h -> h.onExit().thenRun(() -> System.exit(0)),
+            () -> System.exit(0));
+
+        final ServerSocket server = new ServerSocket(0, 50, InetAddress.getLoopbackAddress());
+
+        // Write the port atomically, so vdiff never reads a partial file.
+        final Path portFile = Paths.get(args[1]);
+        final Path tmpFile = portFile.resolveSibling(portFile.getFileName() + ".tmp");
+        Files.write(tmpFile, Integer.toString(server.getLocalPort()).getBytes(StandardCharsets.UTF_8));
+        Files.move(tmpFile, portFile, StandardCopyOption.REPLACE_EXISTING,
+                   StandardCopyOption.ATOMIC_MOVE);
+
+        while (true) {
+            final Socket socket = server.accept();
+            final Thread thread = new Thread(() -> handle(entry, socket));
+            thread.setDaemon(true);
+            thread.start();
+        }
+    }
+
+    private static Method loadEntryPoint(File jar) throws Exception {
+        String mainClass;
+        try (JarFile file = new JarFile(jar)) {
+            mainClass = file.getManifest().getMainAttributes().getValue(Attributes.Name.MAIN_CLASS);
+        }
+
+        if (mainClass == null) {
+            throw new IllegalArgumentException(jar + " has no Main-Class");
+        }
+
+        final URLClassLoader loader = new URLClassLoader(new URL[] { jar.toURI().toURL() },
+                                                         RenderServer.class.getClassLoader());
+        return Class.forName(mainClass, true, loader).getMethod("main", String[].class);
+    }
+
+    // Returns false when the JVM doesn't allow a security manager (Java 18+).
+    @SuppressWarnings("removal")
+    private static boolean trapExit() {
+        try {
+            System.setSecurityManager(new ExitTrap());
+            return true;
+        } catch (UnsupportedOperationException | SecurityException e) {
+            return false;
+        }
+    }
+
+    private static void registerCaptureWriter() {
+        final IIORegistry registry = IIORegistry.getDefaultInstance();
+        final CaptureWriterSpi capture = new CaptureWriterSpi();
+        registry.registerServiceProvider(capture, ImageWriterSpi.class);
+
+        final Iterator<ImageWriterSpi> it = registry.getServiceProviders(ImageWriterSpi.class, true);
+        while (it.hasNext()) {
+            final ImageWriterSpi spi = it.next();
+            if (spi != capture) {
+                registry.setOrdering(ImageWriterSpi.class, capture, spi);
+            }
+        }
+    }
+
+    private static void handle(Method entry, Socket socket) {
+        try (Socket s = socket;
+             BufferedReader in = new BufferedReader(
+                 new InputStreamReader(s.getInputStream(), StandardCharsets.UTF_8));
+             OutputStream out = new BufferedOutputStream(s.getOutputStream())) {
+            final String line = in.readLine();
+            if (line == null) {
+                return;
+            }
+
+            final String[] args = line.split("\t", -1);
+            final File outFile = new File(args[args.length - 1]);
+
+            BufferedImage image = null;
+            String error = null;
+            if (jobLock != null) {
+                jobLock.lock();
+            }
+            final long cpuStart = threadCpuTime();
+            CAPTURING.set(Boolean.TRUE);
+            try {
+                try {
+                    entry.invoke(null, (Object) args);
+                } catch (InvocationTargetException e) {
+                    // A successful exit still leaves an image behind.
+                    if (!(e.getCause() instanceof ExitException)) {
+                        throw e;
+                    }
+
+                    final int status = ((ExitException) e.getCause()).status;
+                    if (status != 0) {
+                        throw new IllegalStateException("exited with code " + status);
+                    }
+                }
+
+                image = toArgb(CAPTURED.get());
+                if (image == null) {
+                    image = toArgb(ImageIO.read(outFile));
+                }
+
+                if (image == null) {
+                    error = "no image was produced";
+                }
+            } catch (InvocationTargetException e) {
+                error = describe(e.getCause());
+            } catch (Throwable e) {
+                error = describe(e);
+            } finally {
+                CAPTURING.remove();
+                CAPTURED.remove();
+                outFile.delete();
+                if (jobLock != null) {
+                    jobLock.unlock();
+                }
+            }
+
+            final long cpuTime = cpuStart < 0 ? -1 : (threadCpuTime() - cpuStart) / 1000;
+
+            if (error != null) {
+                out.write(("ERROR\t" + error + "\n").getBytes(StandardCharsets.UTF_8));
+            } else {
+                writeImage(out, image, cpuTime);
+            }
+            out.flush();
+        } catch (IOException e) {
+            // vdiff went away, nothing to report.
+        }
+    }
+
+    private static BufferedImage toArgb(RenderedImage img) {
+        if (img == null) {
+            return null;
+        }
+
+        if (img instanceof BufferedImage && ((BufferedImage) img).getType() == BufferedImage.TYPE_INT_ARGB) {
+            return (BufferedImage) img;
+        }
+
+        final BufferedImage argb = new BufferedImage(img.getWidth(), img.getHeight(),
+                                                     BufferedImage.TYPE_INT_ARGB);
+        final Graphics2D g = argb.createGraphics();
+        g.drawRenderedImage(img, new AffineTransform());
+        g.dispose();
+        return argb;
+    }
+
+    // In ns, -1 when not supported.
+    private static long threadCpuTime() {
+        final ThreadMXBean bean = ManagementFactory.getThreadMXBean();
+        try {
+            return bean.isCurrentThreadCpuTimeSupported() ? bean.getCurrentThreadCpuTime() : -1;
+        } catch (UnsupportedOperationException e) {
+            return -1;
+        }
+    }
+
+    // Matches QImage::Format_ARGB32 on little-endian machines.
+    private static void writeImage(OutputStream out, BufferedImage image, long cpuTime)
+            throws IOException {
+        final int w = image.getWidth();
+        final int h = image.getHeight();
+        out.write(("IMAGE\t" + w + "\t" + h + "\t" + cpuTime + "\n")
+                  .getBytes(StandardCharsets.UTF_8));
+
+        final int[] row = new int[w];
+        final ByteBuffer buf = ByteBuffer.allocate(w * 4).order(ByteOrder.LITTLE_ENDIAN);
+        for (int y = 0; y < h; y++) {
+            image.getRGB(0, y, w, 1, row, 0, w);
+            buf.clear();
+            buf.asIntBuffer().put(row);
+            out.write(buf.array(), 0, w * 4);
+        }
+    }
+
+    private static String describe(Throwable e) {
+        return String.valueOf(e).replace('\n', ' ').replace('\t', ' ');
+    }
+
+    private static ImageWriter defaultPngWriter() {
+        final Iterator<ImageWriter> it = ImageIO.getImageWritersByFormatName("png");
+        while (it.hasNext()) {
+            final ImageWriter writer = it.next();
+            if (!(writer instanceof CaptureWriter)) {
+                return writer;
+            }
+        }
+
+        return null;
+    }
+
+    // Keeps the image of a job in memory instead of encoding it.
+    // Writes from other threads go to the default PNG writer.
+    private static class CaptureWriter extends ImageWriter {
+        private ImageWriter png;
+
+        CaptureWriter(ImageWriterSpi spi) {
+            super(spi);
+        }
+
+        private ImageWriter png() {
+            if (png == null) {
+                png = defaultPngWriter();
+            }
+            return png;
+        }
+
+        @Override
+        public void write(IIOMetadata streamMetadata, IIOImage image, ImageWriteParam param)
+                throws IOException {
+            if (CAPTURING.get() != null) {
+                CAPTURED.set(image.getRenderedImage());
+                return;
+            }
+
+            png().setOutput(getOutput());
+            png().write(streamMetadata, image, param);
+        }
+
+        @Override
+        public ImageWriteParam getDefaultWriteParam() {
+            return png().getDefaultWriteParam();
+        }
+
+        @Override
+        public IIOMetadata getDefaultStreamMetadata(ImageWriteParam param) {
+            return png().getDefaultStreamMetadata(param);
+        }
+
+        @Override
+        public IIOMetadata getDefaultImageMetadata(ImageTypeSpecifier type, ImageWriteParam param) {
+            return png().getDefaultImageMetadata(type, param);
+        }
+
+        @Override
+        public IIOMetadata convertStreamMetadata(IIOMetadata inData, ImageWriteParam param) {
+            return png().convertStreamMetadata(inData, param);
+        }
+
+        @Override
+        public IIOMetadata convertImageMetadata(IIOMetadata inData, ImageTypeSpecifier type,
+                                                ImageWriteParam param) {
+            return png().convertImageMetadata(inData, type, param);
+        }
+
+        @Override
+        public void dispose() {
+            if (png != null) {
+                png.dispose();
+            }
+        }
+    }
+
+    private static class ExitException extends SecurityException {
+        final int status;
+
+        ExitException(int status) {
+            super("System.exit(" + status + ")");
+            this.status = status;
+        }
+    }
+
+    // Turns `System.exit` of a job into an exception and allows everything else.
+    @SuppressWarnings("removal")
+    private static class ExitTrap extends SecurityManager {
+        @Override
+        public void checkExit(int status) {
+            if (CAPTURING.get() != null) {
+                throw new ExitException(status);
+            }
+        }
+
+        @Override
+        public void checkPermission(Permission perm) {
+        }
+
+        @Override
+        public void checkPermission(Permission perm, Object context) {
+        }
+    }
+
+    private static class CaptureWriterSpi extends ImageWriterSpi {
+        CaptureWriterSpi() {
+            super("vdiff", "1.0",
+                  new String[] { "png", "PNG" }, new String[] { "png" }, new String[] { "image/png" },
+                  CaptureWriter.class.getName(), STANDARD_OUTPUT_TYPE, null,
+                  false, null, null, null, null,
+                  true, "javax_imageio_png_1.0", null, null, null);
+        }
+
+        @Override
+        public boolean canEncodeImage(ImageTypeSpecifier type) {
+            return true;
+        }
+
+        @Override
+        public ImageWriter createWriterInstance(Object extension) {
+            return new CaptureWriter(this);
+        }
+
+        @Override
+        public String getDescription(Locale locale) {
+            return "vdiff image capture";
+        }
+    }
+}
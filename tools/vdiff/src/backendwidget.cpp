@@ -1,5 +1,6 @@
 #include <QVBoxLayout>
 #include <QLabel>
+#include <QStringList>
 #include <QComboBox>
 
 #include "imageview.h"
@@ -13,6 +14,7 @@ BackendWidget::BackendWidget(const Backend backend, QWidget *parent)
     , m_imageView(new ImageView)
     , m_diffView(new ImageView)
     , m_cmbBoxState(new QComboBox)
+    , m_lblStats(new QLabel)
 {
     auto lay = new QVBoxLayout(this);
     lay->setContentsMargins(QMargins());
@@ -20,9 +22,12 @@ BackendWidget::BackendWidget(const Backend backend, QWidget *parent)
     lay->addWidget(m_imageView);
     lay->addWidget(m_diffView);
     lay->addWidget(m_cmbBoxState, 0, Qt::AlignHCenter);
+    lay->addWidget(m_lblStats);
     lay->addStretch();
 
     m_lblTitle->setAlignment(Qt::AlignCenter);
+    m_lblStats->setAlignment(Qt::AlignCenter);
+    m_lblStats->setEnabled(false); // Dimmed.
 
     m_imageView->setFixedSize(300, 300);
     m_diffView->setFixedSize(300, 300);
@@ -85,10 +90,67 @@ void BackendWidget::setViewSize(const QSize &size)
     m_diffView->setFixedSize(size);
 }
 
+void BackendWidget::setRenderStats(const JobStats &stats)
+{
+    m_renderStats = stats;
+    updateStats();
+}
+
+void BackendWidget::setDiffStats(const JobStats &stats)
+{
+    m_diffStats = stats;
+    updateStats();
+}
+
+void BackendWidget::setDiffMetrics(const DiffMetrics &metrics, const TestState verdict)
+{
+    m_hasMetrics = true;
+    m_metrics = metrics;
+    m_verdict = verdict;
+    updateStats();
+}
+
+void BackendWidget::updateStats()
+{
+    QStringList text;
+    QStringList toolTip;
+    if (!m_renderStats.stages.isEmpty()) {
+        text << QString("render %1 ms").arg(m_renderStats.wallTime() / 1000);
+        toolTip << "Render:\n" + m_renderStats.toString();
+    }
+
+    if (!m_diffStats.stages.isEmpty()) {
+        text << QString("diff %1 ms").arg(m_diffStats.wallTime() / 1000);
+        toolTip << "Diff:\n" + m_diffStats.toString();
+    }
+
+    QString metricsText;
+    if (m_hasMetrics) {
+        metricsText = QString("\nSSIM %1, %2%").arg(m_metrics.ssim, 0, 'f', 3)
+                                                .arg(m_metrics.ratio * 100, 0, 'g', 2);
+        switch (m_verdict) {
+            case TestState::Passed  : metricsText += ", looks passed"; break;
+            case TestState::Failed  : metricsText += ", looks failed"; break;
+            case TestState::Crashed : metricsText += ", crashed"; break;
+            case TestState::Unknown : metricsText += ", needs review"; break;
+        }
+
+        toolTip << "Metrics:\n" + m_metrics.toString();
+    }
+
+    m_lblStats->setText(text.join(", ") + metricsText);
+    m_lblStats->setToolTip(toolTip.join("\n\n"));
+}
+
 void BackendWidget::resetImages()
 {
     m_imageView->resetImage();
     m_diffView->resetImage();
+
+    m_renderStats = JobStats();
+    m_diffStats = JobStats();
+    m_hasMetrics = false;
+    updateStats();
 }
 
 TestState BackendWidget::testState() const
@@ -2,6 +2,8 @@
 
 #include <QWidget>
 
+#include "classifier.h"
+#include "jobstats.h"
 #include "tests.h"
 
 class QLabel;
@@ -25,6 +27,10 @@ public:
     QImage diffImage() const;
     void setAnimationEnabled(bool flag);
     void setViewSize(const QSize &size);
+    void setRenderStats(const JobStats &stats);
+    void setDiffStats(const JobStats &stats);
+    // `verdict` is shown as a hint, the test state is not changed.
+    void setDiffMetrics(const DiffMetrics &metrics, const TestState verdict);
 
     void resetImages();
 
@@ -37,10 +43,19 @@ public:
 signals:
     void testStateChanged();
 
+private:
+    void updateStats();
+
 private:
     const Backend m_backend;
     QLabel * const m_lblTitle;
     ImageView * const m_imageView;
     ImageView * const m_diffView;
     QComboBox * const m_cmbBoxState;
+    QLabel * const m_lblStats;
+    JobStats m_renderStats;
+    JobStats m_diffStats;
+    bool m_hasMetrics = false;
+    DiffMetrics m_metrics;
+    TestState m_verdict = TestState::Unknown;
 };
@@ -0,0 +1,1125 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSysInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include "referencestore.h"
+#include "render.h"
+#include "rendercache.h"
+#include "resultsstore.h"
+#include "settings.h"
+
+#include "batch.h"
+
+namespace {
+
+struct BackendReport
+{
+    Backend type;
+    TestState state;
+    QString error;
+    int mismatch;
+    int pixels;
+    QRect bbox;
+    DiffMetrics metrics;
+    TestState verdict;
+    JobStats render;
+    JobStats diff;
+    QString outputHash; // Empty on error.
+    QString cacheKey; // Empty when the render is not cached.
+};
+
+struct TestReport
+{
+    QString baseName;
+    JobStats reference;
+    QVector<BackendReport> backends;
+};
+
+struct BackendSummary
+{
+    int tests = 0;
+    int errors = 0;
+    int identical = 0;
+    double ratioSum = 0;
+    int verdicts[4] = {}; // Indexed by TestState.
+    qint64 renderTime = 0; // us
+    qint64 diffTime = 0; // us
+};
+
+struct RegressionSummary
+{
+    int unchanged = 0;
+    int changed = 0;
+    int failed = 0;
+    int added = 0;
+};
+
+struct Shard
+{
+    QString name;
+    QStringList tests;
+};
+
+struct Worker
+{
+    QSharedPointer<QProcess> process;
+    QString id;
+};
+
+}
+
+static double mismatchRatio(const BackendReport &r)
+{
+    return r.pixels == 0 ? 0.0 : double(r.mismatch) / r.pixels;
+}
+
+static QString verdictToString(const TestState state)
+{
+    switch (state) {
+        case TestState::Unknown : return "review";
+        case TestState::Passed  : return "passed";
+        case TestState::Failed  : return "failed";
+        case TestState::Crashed : return "crashed";
+    }
+
+    Q_UNREACHABLE();
+}
+
+static QString converterPath(const Settings &settings, const Backend backend)
+{
+    switch (backend) {
+        case Backend::Batik         : return settings.batikPath;
+        case Backend::JSVG          : return settings.jsvgPath;
+        case Backend::SVGSalamander : return settings.svgsalamanderPath;
+        case Backend::EchoSVG       : return settings.echosvgPath;
+        default : return QString();
+    }
+}
+
+// Of the pixels, so PNG encoder settings don't matter.
+static QString imageHash(const QImage &img)
+{
+    const auto argb = img.convertToFormat(QImage::Format_ARGB32);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QString("%1x%2").arg(argb.width()).arg(argb.height()).toUtf8());
+    for (int y = 0; y < argb.height(); ++y) {
+        hash.addData((const char*)argb.constScanLine(y), argb.width() * 4);
+    }
+
+    return hash.result().toHex();
+}
+
+static QJsonObject statsToJson(const JobStats &stats)
+{
+    QJsonArray stages;
+    for (const auto &stage : stats.stages) {
+        stages.append(QJsonArray({ stage.name, double(stage.wallTime) }));
+    }
+
+    QJsonObject obj;
+    obj.insert("stages", stages);
+    obj.insert("cpu", double(stats.cpuTime));
+    obj.insert("rss", double(stats.peakRss));
+    if (!stats.failure.isEmpty()) {
+        obj.insert("failure", stats.failure);
+    }
+
+    return obj;
+}
+
+static JobStats statsFromJson(const QJsonObject &obj)
+{
+    JobStats stats;
+    for (const auto &value : obj.value("stages").toArray()) {
+        const auto stage = value.toArray();
+        stats.stages.append({ stage.at(0).toString(), qint64(stage.at(1).toDouble()) });
+    }
+
+    stats.cpuTime = qint64(obj.value("cpu").toDouble(-1));
+    stats.peakRss = qint64(obj.value("rss").toDouble(-1));
+    stats.failure = obj.value("failure").toString();
+    return stats;
+}
+
+// Everything needed to write the reports in the coordinator of a sharded run.
+static QJsonObject reportToJson(const TestReport &report)
+{
+    QJsonArray backends;
+    for (const auto &r : report.backends) {
+        QJsonObject obj;
+        obj.insert("type", (int)r.type);
+        obj.insert("state", (int)r.state);
+        obj.insert("error", r.error);
+        obj.insert("mismatch", r.mismatch);
+        obj.insert("pixels", r.pixels);
+        obj.insert("bbox", QJsonArray({ r.bbox.x(), r.bbox.y(), r.bbox.width(), r.bbox.height() }));
+        obj.insert("ssim", r.metrics.ssim);
+        obj.insert("ratio", r.metrics.ratio);
+        obj.insert("max_delta", r.metrics.maxDelta);
+        obj.insert("verdict", (int)r.verdict);
+        obj.insert("render", statsToJson(r.render));
+        obj.insert("diff", statsToJson(r.diff));
+        obj.insert("hash", r.outputHash);
+        obj.insert("cache_key", r.cacheKey);
+        backends.append(obj);
+    }
+
+    QJsonObject root;
+    root.insert("test", report.baseName);
+    root.insert("reference", statsToJson(report.reference));
+    root.insert("backends", backends);
+    return root;
+}
+
+static TestReport reportFromJson(const QJsonObject &root)
+{
+    TestReport report;
+    report.baseName = root.value("test").toString();
+    report.reference = statsFromJson(root.value("reference").toObject());
+
+    for (const auto &value : root.value("backends").toArray()) {
+        const auto obj = value.toObject();
+        const auto bbox = obj.value("bbox").toArray();
+
+        BackendReport r;
+        r.type = (Backend)obj.value("type").toInt();
+        r.state = (TestState)obj.value("state").toInt();
+        r.error = obj.value("error").toString();
+        r.mismatch = obj.value("mismatch").toInt();
+        r.pixels = obj.value("pixels").toInt();
+        r.bbox = QRect(bbox.at(0).toInt(), bbox.at(1).toInt(),
+                       bbox.at(2).toInt(), bbox.at(3).toInt());
+        r.metrics.ssim = obj.value("ssim").toDouble();
+        r.metrics.ratio = obj.value("ratio").toDouble();
+        r.metrics.maxDelta = obj.value("max_delta").toInt();
+        r.verdict = (TestState)obj.value("verdict").toInt();
+        r.render = statsFromJson(obj.value("render").toObject());
+        r.diff = statsFromJson(obj.value("diff").toObject());
+        r.outputHash = obj.value("hash").toString();
+        r.cacheKey = obj.value("cache_key").toString();
+        report.backends << r;
+    }
+
+    return report;
+}
+
+// Reads the processed tests of a shard. A line cut by a crashed worker is ignored
+// and, when `truncate` is set, removed, so the next report starts on its own line.
+static QVector<TestReport> readShardLog(const QString &path, bool truncate)
+{
+    QFile file(path);
+    if (!file.open(truncate ? QFile::ReadWrite : QFile::ReadOnly)) {
+        return QVector<TestReport>();
+    }
+
+    QVector<TestReport> reports;
+    qint64 validSize = 0;
+    while (!file.atEnd()) {
+        const auto line = file.readLine();
+        if (!line.endsWith('\n')) {
+            break;
+        }
+
+        const auto doc = QJsonDocument::fromJson(line);
+        if (doc.isObject()) {
+            reports << reportFromJson(doc.object());
+        }
+
+        validSize = file.pos();
+    }
+
+    if (truncate && validSize != file.size()) {
+        file.resize(validSize);
+    }
+
+    return reports;
+}
+
+namespace {
+
+// Appends processed tests to a shard log as soon as they are done,
+// so a crashed worker loses only the tests in flight.
+class ShardLog
+{
+public:
+    explicit ShardLog(const QString &path)
+        : m_file(path)
+    {
+        if (!m_file.open(QFile::WriteOnly | QFile::Append)) {
+            throw QString("Failed to open %1.").arg(path);
+        }
+    }
+
+    void append(const TestReport &report)
+    {
+        const auto line = QJsonDocument(reportToJson(report)).toJson(QJsonDocument::Compact);
+
+        QMutexLocker lock(&m_mutex);
+        m_file.write(line + '\n');
+        m_file.flush();
+    }
+
+private:
+    QMutex m_mutex;
+    QFile m_file;
+};
+
+struct ProcessTest
+{
+    typedef TestReport result_type;
+
+    const Settings &settings;
+    const int viewSize;
+    const int total;
+    QAtomicInt &done;
+    ShardLog *log; // Optional.
+
+    TestReport operator()(const TestItem &item)
+    {
+        TestReport report;
+        report.baseName = item.baseName;
+
+        // This thread only waits, the actual work is done by the scheduler,
+        // which also runs the tasks of other tests in the meantime.
+        auto &scheduler = Scheduler::instance();
+        const auto jobs = Render::prepareJobs(settings, item.path, viewSize);
+        const auto results = scheduler.mapped(jobs, &Render::renderImage, &Render::renderCost,
+                                              Scheduler::Priority::Normal).results();
+
+        const auto &ref = results.first();
+        Q_ASSERT(ref.type == Backend::Reference);
+        report.reference = ref.stats;
+
+        QVector<DiffData> diffs;
+        for (int i = 1; i < results.size(); ++i) {
+            const auto &res = results.at(i);
+
+            // A converter error is a crash. Nothing can be said without a reference.
+            BackendReport r { res.type, item.state.value(res.type), res.error, 0, 0, QRect(),
+                              DiffMetrics(), TestState::Crashed, res.stats, JobStats() };
+            if (!ref.error.isEmpty()) {
+                r.error = ref.error;
+                r.verdict = TestState::Unknown;
+            } else if (res.error.isEmpty()) {
+                diffs.append({ res.type, ref.img, res.img, settings.diffBackground });
+            }
+
+            if (res.error.isEmpty()) {
+                r.outputHash = imageHash(res.img);
+                if (jobs.at(i).useCache) {
+                    r.cacheKey = RenderCache::key(jobs.at(i));
+                }
+            }
+
+            report.backends << r;
+        }
+
+        const auto outputs = scheduler.mapped(diffs, &Render::diffImage, &Render::diffCost,
+                                              Scheduler::Priority::Normal).results();
+        for (const auto &diff : outputs) {
+            for (auto &r : report.backends) {
+                if (r.type == diff.type) {
+                    r.mismatch = diff.mismatches;
+                    r.pixels = diff.img.width() * diff.img.height();
+                    r.bbox = diff.bbox;
+                    r.metrics = diff.metrics;
+                    r.verdict = Classifier::classify(settings.policy(), diff.metrics);
+                    r.diff = diff.stats;
+                }
+            }
+        }
+
+        if (log) {
+            log->append(report);
+        }
+
+        qInfo().noquote() << QString("[%1/%2] %3")
+                             .arg(done.fetchAndAddRelaxed(1) + 1).arg(total).arg(item.baseName);
+
+        return report;
+    }
+};
+
+}
+
+static void writeBackendCsv(const QString &path, const Backend type,
+                            const QVector<TestReport> &reports)
+{
+    QString text = "test,state,error,mismatch,ratio,ssim,max_delta,verdict\n";
+    for (const auto &report : reports) {
+        for (const auto &r : report.backends) {
+            if (r.type != type) {
+                continue;
+            }
+
+            text += TimingsLog::csvField(report.baseName) + ',';
+            text += QString::number((int)r.state) + ',';
+            text += QString(r.error.isEmpty() ? "0" : "1") + ',';
+            text += QString::number(r.mismatch) + ',';
+            text += QString::number(mismatchRatio(r), 'g', 6) + ',';
+            text += QString::number(r.metrics.ssim, 'g', 6) + ',';
+            text += QString::number(r.metrics.maxDelta) + ',';
+            text += verdictToString(r.verdict) + '\n';
+        }
+    }
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        throw QString("Failed to open %1.").arg(path);
+    }
+
+    file.write(text.toUtf8());
+}
+
+static void writeTimingsCsv(const QString &path, const QVector<TestReport> &reports)
+{
+    QString text = TimingsLog::header();
+    for (const auto &report : reports) {
+        text += TimingsLog::row(report.baseName, Backend::Reference, "render", report.reference);
+
+        for (const auto &r : report.backends) {
+            text += TimingsLog::row(report.baseName, r.type, "render", r.render);
+            if (!r.diff.stages.isEmpty()) {
+                text += TimingsLog::row(report.baseName, r.type, "diff", r.diff);
+            }
+        }
+    }
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        throw QString("Failed to open %1.").arg(path);
+    }
+
+    file.write(text.toUtf8());
+}
+
+// Only unreviewed results are classified, a manually set state always wins.
+static int storeVerdicts(const Settings &settings, const QVector<TestReport> &reports)
+{
+    ResultsStore store(settings.resultsPath());
+
+    int count = 0;
+    for (const auto &report : reports) {
+        for (const auto &r : report.backends) {
+            if (r.state == TestState::Unknown && r.verdict != TestState::Unknown) {
+                store.setState(report.baseName, r.type, r.verdict);
+                count++;
+            }
+        }
+    }
+
+    store.exportCsv();
+    return count;
+}
+
+// Renders with a different hash can still be the same within the tolerance,
+// when both of them are in the render cache.
+static bool isSameOutput(const ResultsStore::Output &prev, const BackendReport &r,
+                         const int tolerance, const QRgb background)
+{
+    if (prev.hash == r.outputHash) {
+        return true;
+    }
+
+    if (tolerance <= 0 || prev.cacheKey.isEmpty() || r.cacheKey.isEmpty()) {
+        return false;
+    }
+
+    const auto prevImg = RenderCache::load(r.type, prev.cacheKey);
+    const auto img = RenderCache::load(r.type, r.cacheKey);
+    if (prevImg.isNull() || img.isNull() || prevImg.size() != img.size()) {
+        return false;
+    }
+
+    const auto diff = Render::diffImage({ r.type, prevImg, img, background });
+    return diff.metrics.maxDelta <= tolerance;
+}
+
+static void resetState(ResultsStore *store, const QString &baseName, BackendReport *r)
+{
+    if (r->state != TestState::Unknown) {
+        store->setState(baseName, r->type, TestState::Unknown);
+        r->state = TestState::Unknown;
+    }
+}
+
+// Compares renders with the ones recorded by the previous runs.
+//
+// A recorded output is replaced only by a render of the same converter,
+// unless in the regression mode. So a converter can be upgraded and checked later.
+// In the regression mode, changed results and failed renders of tests with a recorded output
+// are reset to be reviewed again, while unchanged ones keep their state.
+static void compareOutputs(const Settings &settings, const Batch::Options &opt,
+                           const int viewSize, const QVector<Backend> &backends,
+                           QVector<TestReport> &reports)
+{
+    ResultsStore store(settings.resultsPath());
+
+    QString text = "test,backend,status\n";
+    for (const auto type : backends) {
+        const QString converter = RenderCache::converterHash(converterPath(settings, type)).toHex();
+        const auto prevOutputs = store.outputs(type, viewSize);
+
+        QHash<QString, ResultsStore::Output> outputs;
+        RegressionSummary summary;
+        for (auto &report : reports) {
+            for (auto &r : report.backends) {
+                if (r.type != type) {
+                    continue;
+                }
+
+                const auto prev = prevOutputs.constFind(report.baseName);
+
+                // The converter has crashed or timed out. The recorded output is kept,
+                // so the next run is still compared with it. A result already reviewed
+                // as crashed stays so.
+                if (r.outputHash.isEmpty()) {
+                    if (opt.regression && prev != prevOutputs.constEnd()) {
+                        summary.failed++;
+                        text += QString("%1,%2,failed\n")
+                                .arg(TimingsLog::csvField(report.baseName),
+                                     backendToString(type));
+                        if (r.state != TestState::Crashed) {
+                            resetState(&store, report.baseName, &r);
+                        }
+                    }
+
+                    continue;
+                }
+
+                const ResultsStore::Output output { converter, r.outputHash, r.cacheKey };
+                if (prev == prevOutputs.constEnd()) {
+                    outputs.insert(report.baseName, output);
+                    summary.added++;
+                    continue;
+                }
+
+                if (prev->converter == converter || opt.regression) {
+                    outputs.insert(report.baseName, output);
+                }
+
+                if (!opt.regression) {
+                    continue;
+                }
+
+                if (isSameOutput(*prev, r, opt.tolerance, settings.diffBackground)) {
+                    summary.unchanged++;
+                    continue;
+                }
+
+                summary.changed++;
+                text += QString("%1,%2,changed\n")
+                        .arg(TimingsLog::csvField(report.baseName), backendToString(type));
+                resetState(&store, report.baseName, &r);
+            }
+        }
+
+        store.setOutputs(type, viewSize, outputs);
+
+        if (opt.regression) {
+            qInfo().noquote() << QString("%1: %2 unchanged, %3 changed, %4 failed, %5 new.")
+                                 .arg(backendToString(type)).arg(summary.unchanged)
+                                 .arg(summary.changed).arg(summary.failed)
+                                 .arg(summary.added);
+        }
+    }
+
+    if (opt.regression) {
+        store.exportCsv();
+
+        const auto path = opt.outDir + "/regression.csv";
+        QFile file(path);
+        if (!file.open(QFile::WriteOnly)) {
+            throw QString("Failed to open %1.").arg(path);
+        }
+
+        file.write(text.toUtf8());
+    }
+}
+
+static void writeSummary(const QString &path, const Settings &settings, const int viewSize,
+                         const QVector<Backend> &backends, const QVector<TestReport> &reports,
+                         const qint64 elapsed)
+{
+    QHash<Backend, BackendSummary> summaries;
+    QJsonArray results;
+    for (const auto &report : reports) {
+        QJsonObject test;
+        test.insert("test", report.baseName);
+
+        for (const auto &r : report.backends) {
+            auto &summary = summaries[r.type];
+            summary.tests++;
+            summary.renderTime += r.render.wallTime();
+            summary.diffTime += r.diff.wallTime();
+
+            summary.verdicts[(int)r.verdict]++;
+
+            QJsonObject obj;
+            obj.insert("state", (int)r.state);
+            obj.insert("verdict", verdictToString(r.verdict));
+            if (!r.error.isEmpty()) {
+                summary.errors++;
+                obj.insert("error", r.error);
+            } else {
+                if (r.mismatch == 0) {
+                    summary.identical++;
+                }
+
+                summary.ratioSum += mismatchRatio(r);
+                obj.insert("mismatch", r.mismatch);
+                obj.insert("ratio", mismatchRatio(r));
+                obj.insert("ssim", r.metrics.ssim);
+                obj.insert("max_delta", r.metrics.maxDelta);
+                if (!r.bbox.isEmpty()) {
+                    obj.insert("bbox", QJsonArray({ r.bbox.x(), r.bbox.y(),
+                                                    r.bbox.width(), r.bbox.height() }));
+                }
+            }
+
+            test.insert(backendToString(r.type), obj);
+        }
+
+        results.append(test);
+    }
+
+    QJsonObject backendsObj;
+    for (const auto type : backends) {
+        const auto summary = summaries.value(type);
+        const int rendered = summary.tests - summary.errors;
+
+        QJsonObject obj;
+        obj.insert("tests", summary.tests);
+        obj.insert("errors", summary.errors);
+        obj.insert("identical", summary.identical);
+        obj.insert("mean_ratio", rendered == 0 ? 0.0 : summary.ratioSum / rendered);
+
+        QJsonObject verdicts;
+        for (const auto state : { TestState::Passed, TestState::Failed, TestState::Crashed,
+                                  TestState::Unknown }) {
+            verdicts.insert(verdictToString(state), summary.verdicts[(int)state]);
+        }
+        obj.insert("verdicts", verdicts);
+
+        obj.insert("render_ms", summary.renderTime / 1000);
+        obj.insert("diff_ms", summary.diffTime / 1000);
+        backendsObj.insert(backendToString(type), obj);
+    }
+
+    QJsonObject root;
+    root.insert("suite", settings.testSuite == TestSuite::Own ? "resvg" : "custom");
+    root.insert("view_size", viewSize);
+    root.insert("tests", reports.size());
+    root.insert("elapsed_ms", elapsed);
+    root.insert("backends", backendsObj);
+    root.insert("results", results);
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        throw QString("Failed to open %1.").arg(path);
+    }
+
+    file.write(QJsonDocument(root).toJson());
+}
+
+static const int MaxShardSize = 200; // tests
+static const int HashShardsPerWorker = 4;
+static const int MaxCrashesPerWorker = 3;
+static const int LeaseRefresh = 10000; // ms
+static const int LeaseTimeout = 120000; // ms
+
+// Tests of a group share resources and are similarly slow, so they are kept together,
+// while large groups are split to balance the workers.
+static QVector<Shard> splitShards(const QVector<TestItem> &items, const Batch::Options &opt)
+{
+    QVector<Shard> shards;
+    if (opt.shardBy == "hash") {
+        const int count = qMax(1, opt.shards * HashShardsPerWorker);
+        for (int i = 0; i < count; ++i) {
+            shards.append({ QString("hash-%1").arg(i, 3, 10, QChar('0')), QStringList() });
+        }
+
+        for (const auto &item : items) {
+            const auto hash = QCryptographicHash::hash(item.baseName.toUtf8(),
+                                                       QCryptographicHash::Sha1);
+            const auto n = hash.left(4).toHex().toUInt(nullptr, 16);
+            shards[int(n % quint32(count))].tests << item.baseName;
+        }
+    } else {
+        QMap<QString, QStringList> groups;
+        for (const auto &item : items) {
+            groups[item.baseName.section('/', 0, 0)] << item.baseName;
+        }
+
+        static const QRegularExpression invalidChars("[^A-Za-z0-9_.-]");
+        for (auto it = groups.constBegin(); it != groups.constEnd(); ++it) {
+            const auto group = QString(it.key()).replace(invalidChars, "_");
+            const auto &tests = it.value();
+            for (int i = 0; i < tests.size(); i += MaxShardSize) {
+                shards.append({ QString("%1-%2").arg(group).arg(i / MaxShardSize),
+                                tests.mid(i, MaxShardSize) });
+            }
+        }
+    }
+
+    QVector<Shard> nonEmpty;
+    for (const auto &shard : shards) {
+        if (!shard.tests.isEmpty()) {
+            nonEmpty << shard;
+        }
+    }
+
+    return nonEmpty;
+}
+
+static QString workerId(const qint64 pid)
+{
+    return QString("%1-%2").arg(QSysInfo::machineHostName()).arg(pid);
+}
+
+namespace {
+
+// Touches a claimed shard while it's processed, so the coordinator can tell
+// the shards of a live worker from the ones of a worker that has vanished.
+class LeaseKeeper : public QThread
+{
+public:
+    explicit LeaseKeeper(const QString &path)
+        : m_path(path)
+    {
+        start();
+    }
+
+    ~LeaseKeeper()
+    {
+        m_stop.release();
+        wait();
+    }
+
+protected:
+    void run() override
+    {
+        do {
+            // The shard could have been requeued after a long stall, don't bring it back.
+            QFile file(m_path);
+            if (file.open(QFile::ReadWrite | QFile::ExistingOnly)) {
+                file.setFileTime(QDateTime::currentDateTimeUtc(), QFile::FileModificationTime);
+            }
+        } while (!m_stop.tryAcquire(1, LeaseRefresh));
+    }
+
+private:
+    const QString m_path;
+    QSemaphore m_stop;
+};
+
+}
+
+// Processes the tests of a claimed shard, skipping the ones already processed
+// by a crashed worker. Returns the number of processed tests.
+static int processShard(const Settings &settings, const int viewSize, const QString &spoolDir,
+                        const QString &shard, const QString &claimedPath,
+                        const QHash<QString, TestItem> &itemsByName)
+{
+    QFile file(claimedPath);
+    if (!file.open(QFile::ReadOnly)) {
+        throw QString("Failed to open %1.").arg(claimedPath);
+    }
+
+    const auto logPath = QString("%1/done/%2.jsonl").arg(spoolDir, shard);
+
+    QSet<QString> processed;
+    for (const auto &report : readShardLog(logPath, true)) {
+        processed.insert(report.baseName);
+    }
+
+    QVector<TestItem> items;
+    for (const auto &name : QString::fromUtf8(file.readAll()).split('\n')) {
+        if (!name.isEmpty() && !processed.contains(name) && itemsByName.contains(name)) {
+            items << itemsByName.value(name);
+        }
+    }
+
+    qInfo().noquote() << QString("Shard %1: %2 tests.").arg(shard).arg(items.size());
+
+    LeaseKeeper lease(claimedPath);
+    ShardLog log(logPath);
+    QAtomicInt done;
+    QtConcurrent::blockingMapped<QVector<TestReport>>(
+        items, ProcessTest { settings, viewSize, items.size(), done, &log });
+
+    return items.size();
+}
+
+// Takes shards from the queue until it's empty. Returns the number of processed tests.
+static int runWorker(const Settings &settings, const int viewSize, const QString &spoolDir,
+                     const QVector<TestItem> &items)
+{
+    QHash<QString, TestItem> itemsByName;
+    for (const auto &item : items) {
+        itemsByName.insert(item.baseName, item);
+    }
+
+    const QDir queue(spoolDir + "/queue");
+    const auto id = workerId(QCoreApplication::applicationPid());
+
+    int count = 0;
+    while (true) {
+        const auto names = queue.entryList({ "*.txt" }, QDir::Files, QDir::Name);
+        if (names.isEmpty()) {
+            break;
+        }
+
+        for (const auto &fileName : names) {
+            const auto shard = QFileInfo(fileName).completeBaseName();
+            const auto queuedPath = queue.filePath(fileName);
+            const auto claimedPath = QString("%1/claimed/%2@%3.txt").arg(spoolDir, shard, id);
+
+            // Only one worker can move the file, the others will try the next one.
+            if (!QFile::rename(queuedPath, claimedPath)) {
+                if (QFile::exists(queuedPath)) {
+                    throw QString("Failed to claim %1.").arg(queuedPath);
+                }
+
+                continue;
+            }
+
+            count += processShard(settings, viewSize, spoolDir, shard, claimedPath, itemsByName);
+            QFile::remove(claimedPath);
+
+            // A crashed worker could have returned shards to the queue in the meantime.
+            break;
+        }
+    }
+
+    return count;
+}
+
+static Worker startWorker(const QStringList &args)
+{
+    Worker worker { QSharedPointer<QProcess>::create(), QString() };
+    worker.process->setProcessChannelMode(QProcess::ForwardedChannels);
+    worker.process->start(QCoreApplication::applicationFilePath(), args);
+    if (!worker.process->waitForStarted()) {
+        throw QString("Failed to start a worker.");
+    }
+
+    worker.id = workerId(worker.process->processId());
+    return worker;
+}
+
+// Returns the shards claimed by a dead worker to the queue.
+// Its processed tests stay in `done`, so only the rest will be processed again.
+static int requeueShards(const QString &spoolDir, const QString &id)
+{
+    const QDir claimed(spoolDir + "/claimed");
+
+    int count = 0;
+    for (const auto &fileName : claimed.entryList({ "*@" + id + ".txt" }, QDir::Files)) {
+        const auto shard = fileName.section('@', 0, 0);
+        const auto queuedPath = QString("%1/queue/%2.txt").arg(spoolDir, shard);
+        if (QFile::rename(claimed.filePath(fileName), queuedPath)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Returns the shards whose lease has expired to the queue. Their worker is gone,
+// which is the only way to notice it for the workers on other hosts.
+static int requeueStaleShards(const QString &spoolDir)
+{
+    const QDir claimed(spoolDir + "/claimed");
+    const auto now = QDateTime::currentDateTimeUtc();
+
+    int count = 0;
+    for (const auto &info : claimed.entryInfoList({ "*.txt" }, QDir::Files)) {
+        if (info.lastModified().toUTC().msecsTo(now) < LeaseTimeout) {
+            continue;
+        }
+
+        const auto shard = info.fileName().section('@', 0, 0);
+        const auto queuedPath = QString("%1/queue/%2.txt").arg(spoolDir, shard);
+        if (QFile::rename(info.filePath(), queuedPath)) {
+            qWarning().noquote() << QString("The lease of %1 has expired, the shard is requeued.")
+                                    .arg(info.fileName());
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static bool hasQueuedShards(const QString &spoolDir)
+{
+    return !QDir(spoolDir + "/queue").entryList({ "*.txt" }, QDir::Files).isEmpty();
+}
+
+static bool hasClaimedShards(const QString &spoolDir)
+{
+    return !QDir(spoolDir + "/claimed").entryList({ "*.txt" }, QDir::Files).isEmpty();
+}
+
+// Runs `opt.shards` workers of this executable and merges their results
+// in the order of `items`, regardless of which worker processed them and when.
+// Tests that were never processed, because the workers kept crashing, are missing.
+static QVector<TestReport> runShards(const Settings &settings, const Batch::Options &opt,
+                                     const int viewSize, const QVector<Backend> &backends,
+                                     const QVector<TestItem> &items)
+{
+    const auto spoolDir = opt.spoolDir.isEmpty() ? opt.outDir + "/spool" : opt.spoolDir;
+
+    // Results of a previous run can't be reused, since the settings could have changed.
+    for (const auto name : { "queue", "claimed", "done" }) {
+        QDir dir(spoolDir + '/' + name);
+        if (!dir.removeRecursively() || !QDir().mkpath(dir.path())) {
+            throw QString("Failed to prepare %1.").arg(dir.path());
+        }
+    }
+
+    const auto shards = splitShards(items, opt);
+    for (const auto &shard : shards) {
+        // Workers on other hosts could be already waiting, so they must see complete files only.
+        QSaveFile file(QString("%1/queue/%2.txt").arg(spoolDir, shard.name));
+        if (!file.open(QFile::WriteOnly)) {
+            throw QString("Failed to open %1.").arg(file.fileName());
+        }
+
+        file.write(shard.tests.join('\n').toUtf8() + '\n');
+        if (!file.commit()) {
+            throw QString("Failed to write %1.").arg(file.fileName());
+        }
+    }
+
+    qInfo().noquote() << QString("Split %1 tests into %2 shards.")
+                         .arg(items.size()).arg(shards.size());
+
+    QStringList args;
+    args << "--batch" << "--worker" << spoolDir << "--view-size" << QString::number(viewSize);
+    for (const auto type : backends) {
+        args << "--backend" << backendToString(type);
+    }
+
+    // Local workers share the cores, the Java jobs and the memory budget,
+    // so a sharded run doesn't use more than a single process would.
+    args << "--share" << QString::number(opt.shards);
+    if (opt.jobs > 0) {
+        args << "--jobs" << QString::number(qMax(1, opt.jobs / opt.shards));
+    }
+
+    if (!settings.useRenderCache) {
+        args << "--no-cache";
+    }
+
+    QVector<Worker> workers;
+    for (int i = 0; i < opt.shards; ++i) {
+        workers << startWorker(args);
+    }
+
+    // A worker exits once the queue is empty. A crashed one is restarted,
+    // as long as there is something left to do. Shards claimed by workers on other hosts
+    // are waited for, and requeued once their lease expires.
+    int crashes = 0;
+    bool isWaiting = false;
+    while (true) {
+        requeueStaleShards(spoolDir);
+
+        int running = 0;
+        for (auto &worker : workers) {
+            if (worker.process && worker.process->state() != QProcess::NotRunning) {
+                running++;
+                continue;
+            }
+
+            if (worker.process) {
+                if (worker.process->exitStatus() != QProcess::NormalExit
+                    || worker.process->exitCode() != 0)
+                {
+                    crashes++;
+                    const int count = requeueShards(spoolDir, worker.id);
+                    qWarning().noquote()
+                        << QString("Worker %1 has crashed, %2 shards are requeued.")
+                           .arg(worker.id).arg(count);
+                }
+
+                worker.process.reset();
+            }
+
+            if (hasQueuedShards(spoolDir) && crashes <= MaxCrashesPerWorker * opt.shards) {
+                worker = startWorker(args);
+                running++;
+            }
+        }
+
+        if (running == 0 && !hasClaimedShards(spoolDir)
+            && (!hasQueuedShards(spoolDir) || crashes > MaxCrashesPerWorker * opt.shards))
+        {
+            break;
+        }
+
+        if (running == 0 && !isWaiting) {
+            qInfo().noquote() << "Waiting for the shards claimed by other workers.";
+            isWaiting = true;
+        }
+
+        QThread::msleep(200);
+    }
+
+    QHash<QString, TestReport> processed;
+    const QDir doneDir(spoolDir + "/done");
+    for (const auto &fileName : doneDir.entryList({ "*.jsonl" }, QDir::Files, QDir::Name)) {
+        for (const auto &report : readShardLog(doneDir.filePath(fileName), false)) {
+            if (!processed.contains(report.baseName)) {
+                processed.insert(report.baseName, report);
+            }
+        }
+    }
+
+    QVector<TestReport> reports;
+    for (const auto &item : items) {
+        const auto it = processed.constFind(item.baseName);
+        if (it != processed.constEnd()) {
+            reports << *it;
+        }
+    }
+
+    return reports;
+}
+
+int Batch::run(Settings settings, const Options &opt)
+{
+    if (!opt.backends.isEmpty()) {
+        settings.useBatik = opt.backends.contains(Backend::Batik);
+        settings.useJSVG = opt.backends.contains(Backend::JSVG);
+        settings.useSVGSalamander = opt.backends.contains(Backend::SVGSalamander);
+        settings.useEchoSVG = opt.backends.contains(Backend::EchoSVG);
+    }
+
+    QVector<Backend> backends;
+    if (settings.useBatik)          { backends << Backend::Batik; }
+    if (settings.useJSVG)           { backends << Backend::JSVG; }
+    if (settings.useSVGSalamander)  { backends << Backend::SVGSalamander; }
+    if (settings.useEchoSVG)        { backends << Backend::EchoSVG; }
+
+    const QRegularExpression filter(opt.filter);
+    if (!filter.isValid()) {
+        qCritical().noquote() << QString("Invalid filter: %1").arg(filter.errorString());
+        return 1;
+    }
+
+    const int viewSize = opt.viewSize > 0 ? opt.viewSize : settings.viewSize;
+
+    try {
+        Tests tests;
+        if (settings.testSuite == TestSuite::Custom) {
+            tests = Tests::loadCustom(settings.customTestsPath);
+        } else {
+            tests = Tests::load(settings.testSuite, settings.resultsPath(), settings.testsPath());
+        }
+
+        QVector<TestItem> items;
+        for (const TestItem &item : tests) {
+            if (filter.match(item.baseName).hasMatch()) {
+                items << item;
+            }
+        }
+
+        int cores = QThread::idealThreadCount();
+        if (opt.share > 1) {
+            cores = qMax(1, cores / opt.share);
+            for (int *jobs : { &settings.batikJobs, &settings.jsvgJobs,
+                               &settings.svgsalamanderJobs, &settings.echosvgJobs })
+            {
+                *jobs = qMax(1, *jobs / opt.share);
+            }
+            settings.memoryBudget = qMax(1, settings.memoryBudget / opt.share);
+        }
+
+        Scheduler::instance().configure(settings, cores);
+
+        const int decoded = ReferenceStore::build(settings.testsPath(), viewSize);
+        if (decoded != 0) {
+            qInfo().noquote() << QString("Decoded %1 references.").arg(decoded);
+        }
+
+        // Tests in flight. Their threads mostly wait for the scheduler,
+        // so keep enough of them to saturate it.
+        QThreadPool::globalInstance()->setMaxThreadCount(opt.jobs > 0 ? opt.jobs : cores * 2);
+
+        if (!opt.workerDir.isEmpty()) {
+            const int count = runWorker(settings, viewSize, opt.workerDir, items);
+            qInfo().noquote() << QString("Worker processed %1 tests.").arg(count);
+            return 0;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        QVector<TestReport> reports;
+        if (opt.shards > 0) {
+            reports = runShards(settings, opt, viewSize, backends, items);
+        } else {
+            QAtomicInt done;
+            reports = QtConcurrent::blockingMapped<QVector<TestReport>>(
+                items, ProcessTest { settings, viewSize, items.size(), done, nullptr });
+        }
+
+        const auto elapsed = timer.elapsed();
+
+        if (!QDir().mkpath(opt.outDir)) {
+            throw QString("Failed to create %1.").arg(opt.outDir);
+        }
+
+        // Before the reports, so they show the states after the regression check.
+        compareOutputs(settings, opt, viewSize, backends, reports);
+
+        for (const auto type : backends) {
+            writeBackendCsv(opt.outDir + "/" + backendToString(type).toLower() + ".csv",
+                            type, reports);
+        }
+
+        writeTimingsCsv(opt.outDir + "/timings.csv", reports);
+        writeSummary(opt.outDir + "/summary.json", settings, viewSize, backends, reports, elapsed);
+
+        qInfo().noquote() << QString("Processed %1 tests in %2s.")
+                             .arg(reports.size()).arg(elapsed / 1000.0, 0, 'f', 1);
+
+        if (opt.classify) {
+            const int count = storeVerdicts(settings, reports);
+            qInfo().noquote() << QString("Classified %1 results.").arg(count);
+        }
+
+        if (reports.size() != items.size()) {
+            qCritical().noquote() << QString("%1 tests were not processed.")
+                                     .arg(items.size() - reports.size());
+            return 1;
+        }
+    } catch (const QString &msg) {
+        qCritical().noquote() << msg;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QVector>
+
+#include "tests.h"
+
+class Settings;
+
+// Renders and diffs the whole suite without the GUI.
+//
+// A sharded run splits the tests into a spool directory, which worker processes take
+// the shards from. Workers write each processed test into the spool right away,
+// so the tests processed by a crashed worker are kept and the rest of its shard
+// is taken by a restarted one. Workers on other hosts can share the same spool.
+// A worker keeps touching its claimed shard, so a shard that isn't touched for a while
+// is returned to the queue. The coordinator waits until all shards are done.
+// Local workers split the resources of the machine between them.
+//
+// Spool layout:
+// - `queue/<shard>.txt` - names of the tests of a shard waiting for a worker;
+// - `claimed/<shard>@<worker>.txt` - a shard taken by a worker, moved atomically,
+//   its modification time is the lease;
+// - `done/<shard>.jsonl` - processed tests, one JSON object per line.
+class Batch
+{
+public:
+    struct Options
+    {
+        QString outDir;
+        QString filter;
+        QVector<Backend> backends;
+        int viewSize = 0;
+        int jobs = 0;
+        bool classify = false; // Store the automatic verdicts of unreviewed results.
+        bool regression = false; // Reset the results whose render has changed.
+        int tolerance = 0; // The largest channel difference of an unchanged render.
+        int shards = 0; // Local worker processes, 0 to process the tests in this one.
+        QString shardBy = "group"; // Split tests by `group` directory or by `hash`.
+        QString spoolDir; // Shards and results of the workers, `outDir/spool` by default.
+        QString workerDir; // Only process the shards of this spool, as a worker.
+        int share = 1; // Use 1/share of the cores, Java jobs and memory budget.
+    };
+
+    static int run(Settings settings, const Options &opt);
+};
@@ -0,0 +1,26 @@
+#include "classifier.h"
+
+QString DiffMetrics::toString() const
+{
+    return QString("SSIM %1, mismatch %2%, max delta %3")
+        .arg(ssim, 0, 'f', 4)
+        .arg(ratio * 100, 0, 'g', 3)
+        .arg(maxDelta);
+}
+
+TestState Classifier::classify(const ClassifyPolicy &policy, const DiffMetrics &metrics)
+{
+    if (metrics.maxDelta <= policy.passMaxDelta && metrics.ratio < policy.failRatio) {
+        return TestState::Passed;
+    }
+
+    if (metrics.ratio <= policy.passRatio && metrics.ssim >= policy.passSsim) {
+        return TestState::Passed;
+    }
+
+    if (metrics.ratio >= policy.failRatio || metrics.ssim < policy.failSsim) {
+        return TestState::Failed;
+    }
+
+    return TestState::Unknown;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QString>
+
+#include "tests.h"
+
+// How far a backend render is from the reference.
+struct DiffMetrics
+{
+    double ssim = 1.0; // Mean structural similarity of the luma, 1 for identical images.
+    double ratio = 0.0; // Mismatched pixels to all pixels.
+    int maxDelta = 0; // The largest channel difference, 0..255.
+
+    QString toString() const;
+};
+
+// Thresholds of the automatic classification.
+// A result is passed when it is clearly close to the reference, failed when it's clearly not,
+// and everything in between is left for a review.
+struct ClassifyPolicy
+{
+    double passRatio = 0.0005;
+    double passSsim = 0.995;
+    // Passed regardless of SSIM, as long as less than `failRatio` of pixels are mismatched.
+    // Small, since a uniform shift of colors, like a wrong opacity or gamma, is a failure.
+    int passMaxDelta = 4;
+    double failRatio = 0.02;
+    double failSsim = 0.95;
+};
+
+class Classifier
+{
+public:
+    // Returns TestState::Unknown for ambiguous results.
+    static TestState classify(const ClassifyPolicy &policy, const DiffMetrics &metrics);
+};
@@ -0,0 +1,284 @@
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VDIFF_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "diffkernel.h"
+
+namespace {
+
+typedef int (*CompareRowFn)(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                            int maxDistance2, int *minX, int *maxX);
+
+struct Kernel
+{
+    CompareRowFn fn;
+    const char *name;
+};
+
+const QRgb Mismatch = 0xffff0000; // qRgb(255, 0, 0)
+const QRgb Match = 0xffffffff; // qRgb(255, 255, 255)
+
+}
+
+static inline int distance2(const QRgb c1, const QRgb c2)
+{
+    const int rd = qRed(c1) - qRed(c2);
+    const int gd = qGreen(c1) - qGreen(c2);
+    const int bd = qBlue(c1) - qBlue(c2);
+    return rd * rd + gd * gd + bd * bd;
+}
+
+static int compareRowScalar(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                            int maxDistance2, int *minX, int *maxX)
+{
+    int count = 0;
+    for (int x = 0; x < width; ++x) {
+        if (distance2(row1[x], row2[x]) > maxDistance2) {
+            out[x] = Mismatch;
+            if (count == 0) {
+                *minX = x;
+            }
+            *maxX = x;
+            count++;
+        } else {
+            out[x] = Match;
+        }
+    }
+
+    return count;
+}
+
+#ifdef VDIFF_X86_SIMD
+
+// Accumulates a mismatch bitmask of pixels starting at `x`.
+static inline void addMask(unsigned bits, int x, int &count, int *minX, int *maxX)
+{
+    if (bits == 0) {
+        return;
+    }
+
+    if (count == 0) {
+        *minX = x + __builtin_ctz(bits);
+    }
+    *maxX = x + 31 - __builtin_clz(bits);
+    count += __builtin_popcount(bits);
+}
+
+// Squared RGB distance of 4 pixels.
+static inline __m128i distance2SSE2(__m128i a, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+    a = _mm_and_si128(a, rgbMask);
+    b = _mm_and_si128(b, rgbMask);
+
+    // Each pixel is split into two pairs of 16-bit channels: (b, g) and (r, 0).
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    lo = _mm_madd_epi16(lo, lo);
+    hi = _mm_madd_epi16(hi, hi);
+
+    const __m128 lof = _mm_castsi128_ps(lo);
+    const __m128 hif = _mm_castsi128_ps(hi);
+    const __m128i bg = _mm_castps_si128(_mm_shuffle_ps(lof, hif, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i r = _mm_castps_si128(_mm_shuffle_ps(lof, hif, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(bg, r);
+}
+
+static int compareRowSSE2(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                          int maxDistance2, int *minX, int *maxX)
+{
+    const __m128i threshold = _mm_set1_epi32(maxDistance2);
+    const __m128i match = _mm_set1_epi32(int(Match));
+    const __m128i greenBlue = _mm_set1_epi32(0x0000ffff);
+
+    int count = 0;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(row1 + x));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(row2 + x));
+        const __m128i mask = _mm_cmpgt_epi32(distance2SSE2(a, b), threshold);
+        _mm_storeu_si128((__m128i*)(out + x),
+                         _mm_andnot_si128(_mm_and_si128(mask, greenBlue), match));
+        addMask(unsigned(_mm_movemask_ps(_mm_castsi128_ps(mask))), x, count, minX, maxX);
+    }
+
+    if (x < width) {
+        int tailMinX = 0;
+        int tailMaxX = 0;
+        const int n = compareRowScalar(row1 + x, row2 + x, out + x, width - x,
+                                       maxDistance2, &tailMinX, &tailMaxX);
+        if (n != 0) {
+            if (count == 0) {
+                *minX = x + tailMinX;
+            }
+            *maxX = x + tailMaxX;
+            count += n;
+        }
+    }
+
+    return count;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i distance2AVX2(__m256i a, __m256i b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgbMask = _mm256_set1_epi32(0x00ffffff);
+    a = _mm256_and_si256(a, rgbMask);
+    b = _mm256_and_si256(b, rgbMask);
+
+    // Unpacking and shuffling work within 128-bit lanes,
+    // so the pixel order is the same as in the SSE2 version.
+    __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    lo = _mm256_madd_epi16(lo, lo);
+    hi = _mm256_madd_epi16(hi, hi);
+
+    const __m256 lof = _mm256_castsi256_ps(lo);
+    const __m256 hif = _mm256_castsi256_ps(hi);
+    const __m256i bg = _mm256_castps_si256(_mm256_shuffle_ps(lof, hif, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m256i r = _mm256_castps_si256(_mm256_shuffle_ps(lof, hif, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm256_add_epi32(bg, r);
+}
+
+__attribute__((target("avx2")))
+static int compareRowAVX2(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                          int maxDistance2, int *minX, int *maxX)
+{
+    const __m256i threshold = _mm256_set1_epi32(maxDistance2);
+    const __m256i match = _mm256_set1_epi32(int(Match));
+    const __m256i greenBlue = _mm256_set1_epi32(0x0000ffff);
+
+    int count = 0;
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(row1 + x));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(row2 + x));
+        const __m256i mask = _mm256_cmpgt_epi32(distance2AVX2(a, b), threshold);
+        _mm256_storeu_si256((__m256i*)(out + x),
+                            _mm256_andnot_si256(_mm256_and_si256(mask, greenBlue), match));
+        addMask(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(mask))), x, count, minX, maxX);
+    }
+
+    if (x < width) {
+        int tailMinX = 0;
+        int tailMaxX = 0;
+        const int n = compareRowSSE2(row1 + x, row2 + x, out + x, width - x,
+                                     maxDistance2, &tailMinX, &tailMaxX);
+        if (n != 0) {
+            if (count == 0) {
+                *minX = x + tailMinX;
+            }
+            *maxX = x + tailMaxX;
+            count += n;
+        }
+    }
+
+    return count;
+}
+
+#endif // VDIFF_X86_SIMD
+
+static Kernel selectKernel()
+{
+    const char *forced = std::getenv("VDIFF_DIFF_KERNEL");
+    const auto isForced = [forced](const char *name) {
+        return forced && std::strcmp(forced, name) == 0;
+    };
+
+    if (isForced("scalar")) {
+        return { compareRowScalar, "scalar" };
+    }
+
+#ifdef VDIFF_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && !isForced("sse2")) {
+        return { compareRowAVX2, "avx2" };
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return { compareRowSSE2, "sse2" };
+    }
+#endif
+
+    return { compareRowScalar, "scalar" };
+}
+
+static const Kernel& kernel()
+{
+    static const Kernel k = selectKernel();
+    return k;
+}
+
+// Same rounding as QPainter.
+static inline int div255(const int x)
+{
+    return (x + 128 + ((x + 128) >> 8)) >> 8;
+}
+
+void DiffKernel::blendRow(const QRgb *src, bool isPremultiplied, QRgb background, QRgb *out,
+                          int width)
+{
+    const int bgR = qRed(background);
+    const int bgG = qGreen(background);
+    const int bgB = qBlue(background);
+    const QRgb bg = background | 0xff000000;
+
+    for (int x = 0; x < width; ++x) {
+        const QRgb c = src[x];
+        const int a = qAlpha(c);
+        if (a == 255) {
+            out[x] = c;
+        } else if (a == 0) {
+            out[x] = bg;
+        } else {
+            const QRgb p = isPremultiplied ? c : qPremultiply(c);
+            const int ia = 255 - a;
+            out[x] = qRgb(qRed(p) + div255(bgR * ia),
+                          qGreen(p) + div255(bgG * ia),
+                          qBlue(p) + div255(bgB * ia));
+        }
+    }
+}
+
+int DiffKernel::compareRow(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                           int maxDistance2, int *minX, int *maxX)
+{
+    return kernel().fn(row1, row2, out, width, maxDistance2, minX, maxX);
+}
+
+const char* DiffKernel::name()
+{
+    return kernel().name;
+}
+
+int DiffKernel::compareRowWith(const char *kernel, const QRgb *row1, const QRgb *row2,
+                               QRgb *out, int width, int maxDistance2, int *minX, int *maxX)
+{
+    CompareRowFn fn = nullptr;
+    if (std::strcmp(kernel, "scalar") == 0) {
+        fn = compareRowScalar;
+    }
+
+#ifdef VDIFF_X86_SIMD
+    __builtin_cpu_init();
+
+    if (std::strcmp(kernel, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        fn = compareRowSSE2;
+    } else if (std::strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        fn = compareRowAVX2;
+    }
+#endif
+
+    if (!fn) {
+        return -1;
+    }
+
+    return fn(row1, row2, out, width, maxDistance2, minX, maxX);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QRgb>
+
+// Per-pixel blending and comparison of scanlines.
+//
+// The comparison implementation (AVX2, SSE2 or scalar) is selected at runtime
+// and can be forced via the VDIFF_DIFF_KERNEL environment variable.
+namespace DiffKernel {
+    // Composites ARGB32 (premultiplied or not) or RGB32 pixels over the opaque `background`
+    // into RGB32 `out`, like QPainter does.
+    void blendRow(const QRgb *src, bool isPremultiplied, QRgb background, QRgb *out,
+                  int width);
+
+    // Writes red to `out` for pixels whose squared RGB distance is greater than `maxDistance2`
+    // and white otherwise. The alpha channel is ignored.
+    //
+    // Returns the number of mismatched pixels. If it's not zero,
+    // `minX` and `maxX` are set to the first and the last mismatched column.
+    int compareRow(const QRgb *row1, const QRgb *row2, QRgb *out, int width,
+                   int maxDistance2, int *minX, int *maxX);
+
+    const char* name();
+
+    // Runs a specific implementation: "scalar", "sse2" or "avx2".
+    // Returns -1 when it's not supported by the build or the CPU. Used by tests.
+    int compareRowWith(const char *kernel, const QRgb *row1, const QRgb *row2, QRgb *out,
+                       int width, int maxDistance2, int *minX, int *maxX);
+}
@@ -3,7 +3,7 @@
 #include "exportdialog.h"
 #include "ui_exportdialog.h"
 
-ExportDialog::ExportDialog(const QList<Backend> &backends, QWidget *parent)
+ExportDialog::ExportDialog(const QList<Backend> &backends, const bool isBatch, QWidget *parent)
     : QDialog(parent)
     , ui(new Ui::ExportDialog)
 {
@@ -20,6 +20,15 @@ ExportDialog::ExportDialog(const QList<Backend> &backends, QWidget *parent)
     ui->chBoxBSVGSalamander->setChecked(backends.contains(Backend::SVGSalamander));
     ui->chBoxBEchoSVG->setChecked(backends.contains(Backend::EchoSVG));
 
+    ui->filterWidget->setVisible(isBatch);
+
+    ui->cmbBoxFilterState->addItems({ "Failed", "Crashed", "Failed or crashed", "All" });
+    for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+        if (backends.contains((Backend)t)) {
+            ui->cmbBoxFilterBackend->addItem(backendToString((Backend)t), t);
+        }
+    }
+
     ui->buttonBox->button(QDialogButtonBox::Ok)->setText("Export");
 
     adjustSize();
@@ -43,5 +52,16 @@ ExportDialog::Options ExportDialog::options() const
     if (ui->chBoxBSVGSalamander->isChecked())        { opt.backends << Backend::SVGSalamander; }
     if (ui->chBoxBEchoSVG->isChecked())        { opt.backends << Backend::EchoSVG; } 
 
+    if (ui->cmbBoxFilterBackend->count() != 0) {
+        opt.filterBackend = (Backend)ui->cmbBoxFilterBackend->currentData().toInt();
+    }
+
+    switch (ui->cmbBoxFilterState->currentIndex()) {
+        case 0 : opt.filterStates = { TestState::Failed }; break;
+        case 1 : opt.filterStates = { TestState::Crashed }; break;
+        case 2 : opt.filterStates = { TestState::Failed, TestState::Crashed }; break;
+        default : break;
+    }
+
     return opt;
 }
@@ -17,9 +17,14 @@ public:
         bool indicateStatus = false;
         bool showDiff = false;
         QVector<Backend> backends;
+
+        // Batch export only.
+        Backend filterBackend = Backend::Batik;
+        QVector<TestState> filterStates; // Empty for all tests.
     };
 
-    explicit ExportDialog(const QList<Backend> &backends, QWidget *parent = nullptr);
+    // A batch export also asks which tests to export.
+    ExportDialog(const QList<Backend> &backends, const bool isBatch, QWidget *parent = nullptr);
     ~ExportDialog();
 
     Options options() const;
@@ -0,0 +1,152 @@
+#include <QHash>
+#include <QImageReader>
+#include <QMutex>
+#include <QVector>
+
+#include <cstdlib>
+
+#include "imagepool.h"
+
+namespace {
+
+QMutex g_mutex;
+QHash<qint64, QVector<uchar*>> g_buffers; // Class size -> free buffers.
+qint64 g_freeBytes = 0;
+
+}
+
+// The class size is stored in front of the pixels, which stay 64 bytes aligned.
+static const int HeaderSize = 64;
+
+// Smaller buffers are cheap to allocate.
+static const qint64 MinPooledSize = 64 * 1024;
+
+static const qint64 MaxFreeBytes = 256 * 1024 * 1024;
+
+static qint64 classSize(const qint64 size)
+{
+    const int bits = 63 - qCountLeadingZeroBits(quint64(size));
+    const qint64 step = qint64(1) << qMax(0, bits - 3);
+    return (size + step - 1) / step * step;
+}
+
+static uchar* takeBuffer(const qint64 size)
+{
+    {
+        QMutexLocker lock(&g_mutex);
+        auto it = g_buffers.find(size);
+        if (it != g_buffers.end() && !it->isEmpty()) {
+            g_freeBytes -= size;
+            return it->takeLast();
+        }
+    }
+
+    auto base = static_cast<uchar*>(std::malloc(size_t(HeaderSize + size)));
+    if (base) {
+        *reinterpret_cast<qint64*>(base) = size;
+    }
+
+    return base;
+}
+
+// Called by QImage with the buffer of its last copy.
+static void releaseBuffer(void *info)
+{
+    auto base = static_cast<uchar*>(info);
+    const qint64 size = *reinterpret_cast<qint64*>(base);
+
+    {
+        QMutexLocker lock(&g_mutex);
+        if (g_freeBytes + size <= MaxFreeBytes) {
+            g_buffers[size].append(base);
+            g_freeBytes += size;
+            return;
+        }
+    }
+
+    std::free(base);
+}
+
+static void releaseImage(void *info)
+{
+    delete static_cast<QImage*>(info);
+}
+
+// Like QImage, rows are 32-bit aligned.
+static int bytesPerLine(const int width, const QImage::Format format)
+{
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    return ((width * depth + 31) >> 5) << 2;
+}
+
+// Formats without a color table, which is the case for all rendered images.
+static bool isPooledFormat(const QImage::Format format)
+{
+    switch (format) {
+        case QImage::Format_RGB32 :
+        case QImage::Format_ARGB32 :
+        case QImage::Format_ARGB32_Premultiplied : return true;
+        default : return false;
+    }
+}
+
+QImage ImagePool::create(const QSize &size, const QImage::Format format)
+{
+    if (size.isEmpty() || !isPooledFormat(format)) {
+        return QImage(size, format);
+    }
+
+    const int bpl = bytesPerLine(size.width(), format);
+    const qint64 bytes = qint64(bpl) * size.height();
+    if (bytes < MinPooledSize) {
+        return QImage(size, format);
+    }
+
+    auto base = takeBuffer(classSize(bytes));
+    if (!base) {
+        return QImage();
+    }
+
+    return QImage(base + HeaderSize, size.width(), size.height(), bpl, format,
+                  releaseBuffer, base);
+}
+
+// QImageReader decodes into the passed image as is, when its size and format match.
+static QImage decode(QImageReader &reader)
+{
+    QImage img;
+    if (reader.size().isValid() && isPooledFormat(reader.imageFormat())) {
+        img = ImagePool::create(reader.size(), reader.imageFormat());
+    }
+
+    if (!reader.read(&img)) {
+        return QImage();
+    }
+
+    return img;
+}
+
+QImage ImagePool::decode(const QString &path)
+{
+    QImageReader reader(path);
+    return ::decode(reader);
+}
+
+QImage ImagePool::decode(QIODevice *device, const QByteArray &format)
+{
+    QImageReader reader(device, format);
+    return ::decode(reader);
+}
+
+QImage ImagePool::crop(const QImage &img, const QRect &rect)
+{
+    if (rect.isEmpty() || !img.rect().contains(rect) || img.depth() != 32) {
+        return img.copy(rect);
+    }
+
+    // The holder keeps the pixels alive, even after `img` is modified or destroyed.
+    auto holder = new QImage(img);
+    const uchar *bits = holder->constBits() + qint64(rect.y()) * img.bytesPerLine() + rect.x() * 4;
+    return QImage(bits, rect.width(), rect.height(), img.bytesPerLine(), img.format(),
+                  releaseImage, holder);
+}
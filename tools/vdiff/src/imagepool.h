@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QImage>
+
+class QIODevice;
+
+// Recycles the pixel buffers of large images.
+//
+// Rendered, decoded and diff images of a suite mostly have the same few sizes
+// and live only until the next test, so instead of going through malloc each time,
+// their buffers are returned to the pool once the last copy of an image is destroyed.
+// Buffers are grouped by size, rounded up to 1/8 of a power of two.
+// The pool is shared by all threads, since images are usually created by a worker
+// and destroyed by the GUI thread.
+class ImagePool
+{
+public:
+    // Returns an uninitialized image backed by a pooled buffer.
+    static QImage create(const QSize &size, const QImage::Format format);
+
+    // Decodes an image into a pooled buffer. Returns a null image on error.
+    static QImage decode(const QString &path);
+    static QImage decode(QIODevice *device, const QByteArray &format);
+
+    // Returns the `rect` part of `img`, sharing its pixels when possible.
+    // The result is read-only, so writing to it makes a copy.
+    static QImage crop(const QImage &img, const QRect &rect);
+};
@@ -0,0 +1,136 @@
+#include <QFile>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSet>
+#include <QStringList>
+
+#include "jobstats.h"
+
+static QString formatTime(const qint64 us)
+{
+    if (us >= 1000000) {
+        return QString("%1 s").arg(us / 1000000.0, 0, 'f', 2);
+    }
+
+    return QString("%1 ms").arg(us / 1000.0, 0, 'f', 1);
+}
+
+qint64 JobStats::wallTime() const
+{
+    qint64 total = 0;
+    for (const auto &stage : stages) {
+        total += stage.wallTime;
+    }
+
+    return total;
+}
+
+QString JobStats::toString() const
+{
+    QStringList lines;
+    for (const auto &stage : stages) {
+        lines << QString("%1: %2").arg(stage.name, formatTime(stage.wallTime));
+    }
+
+    lines << QString("total: %1").arg(formatTime(wallTime()));
+
+    if (cpuTime >= 0) {
+        lines << QString("converter CPU: %1").arg(formatTime(cpuTime));
+    }
+
+    if (peakRss >= 0) {
+        lines << QString("converter peak RSS: %1 MiB").arg(peakRss / 1024);
+    }
+
+    if (!failure.isEmpty()) {
+        lines << QString("killed: %1").arg(failure);
+    }
+
+    return lines.join('\n');
+}
+
+StageTimer::StageTimer(JobStats *stats)
+    : m_stats(stats)
+{
+    m_timer.start();
+}
+
+void StageTimer::lap(const QString &name)
+{
+    if (!m_stats) {
+        return;
+    }
+
+    m_stats->stages.append({ name, m_timer.nsecsElapsed() / 1000 });
+    m_timer.restart();
+}
+
+void StageTimer::restart()
+{
+    m_timer.restart();
+}
+
+QString TimingsLog::csvField(const QString &text)
+{
+    static const QRegularExpression special("[,\"\r\n]");
+    if (!text.contains(special)) {
+        return text;
+    }
+
+    return '"' + QString(text).replace('"', "\"\"") + '"';
+}
+
+QString TimingsLog::header()
+{
+    return "test,backend,job,wall_us,cpu_us,peak_rss_kib,stages,failure\n";
+}
+
+QString TimingsLog::row(const QString &test, const Backend backend, const QString &job,
+                        const JobStats &stats)
+{
+    QStringList stages;
+    for (const auto &stage : stats.stages) {
+        stages << stage.name + '=' + QString::number(stage.wallTime);
+    }
+
+    return QString("%1,%2,%3,%4,%5,%6,%7,%8\n")
+        .arg(csvField(test), backendToString(backend), job,
+             QString::number(stats.wallTime()), QString::number(stats.cpuTime),
+             QString::number(stats.peakRss), csvField(stages.join(';')),
+             csvField(stats.failure));
+}
+
+void TimingsLog::append(const QString &path, const QString &test, const Backend backend,
+                        const QString &job, const JobStats &stats)
+{
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+
+    // A log with older columns is moved aside to `*.old` and started over.
+    static QSet<QString> checked;
+    if (!checked.contains(path)) {
+        checked.insert(path);
+
+        QFile file(path);
+        if (file.open(QFile::ReadOnly) && file.readLine() != header().toUtf8()) {
+            file.close();
+            QFile::remove(path + ".old");
+            if (!QFile::rename(path, path + ".old")) {
+                qWarning("Failed to move %s aside.", qPrintable(path));
+            }
+        }
+    }
+
+    QFile file(path);
+    const bool isNew = !file.exists();
+    if (!file.open(QFile::WriteOnly | QFile::Append)) {
+        qWarning("Failed to open %s.", qPrintable(path));
+        return;
+    }
+
+    if (isNew) {
+        file.write(header().toUtf8());
+    }
+
+    file.write(row(test, backend, job, stats).toUtf8());
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+#include "tests.h"
+
+// Where the time of a single render or diff job went.
+struct JobStats
+{
+    struct Stage
+    {
+        QString name;
+        qint64 wallTime; // us
+    };
+
+    QVector<Stage> stages;
+    qint64 cpuTime = -1; // Converter CPU time in us, -1 when unknown.
+    qint64 peakRss = -1; // Converter peak RSS in KiB, -1 when unknown, like for render servers.
+    QString failure; // Why the converter was killed, like `timeout` or `memory`.
+
+    qint64 wallTime() const;
+
+    // A multiline, human readable description.
+    QString toString() const;
+};
+
+// Records consecutive stages of a job. Does nothing when `stats` is null.
+class StageTimer
+{
+public:
+    explicit StageTimer(JobStats *stats);
+
+    // Records the time since the previous call or since the construction.
+    void lap(const QString &name);
+
+    // Skips the time since the previous call. For stages recorded elsewhere.
+    void restart();
+
+private:
+    JobStats * const m_stats;
+    QElapsedTimer m_timer;
+};
+
+// A CSV file with one job per row.
+class TimingsLog
+{
+public:
+    // Quotes a CSV field that contains a comma, a quote or a line break.
+    static QString csvField(const QString &text);
+
+    static QString header();
+    static QString row(const QString &test, const Backend backend, const QString &job,
+                       const JobStats &stats);
+
+    // Creates the file with a header when needed.
+    static void append(const QString &path, const QString &test, const Backend backend,
+                       const QString &job, const JobStats &stats);
+};
@@ -1,9 +1,139 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 
+#include "batch.h"
 #include "mainwindow.h"
+#include "rendercache.h"
+#include "renderhistory.h"
+#include "renderserver.h"
+#include "settings.h"
+#include "testindex.h"
+
+static bool isBatchMode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--batch") == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int runBatch(int argc, char *argv[])
+{
+    // Errors are still drawn into images, which requires fonts, but not a display.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication a(argc, argv);
+    a.setOrganizationName("vector");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders and diffs the whole test suite without the GUI.");
+    parser.addHelpOption();
+
+    const QCommandLineOption batchOpt("batch", "Run without the GUI.");
+    const QCommandLineOption outOpt(QStringList({ "o", "output" }),
+                                    "Directory for the reports.", "dir", "vdiff-report");
+    const QCommandLineOption filterOpt("filter",
+                                       "Process only tests matching the regular expression.",
+                                       "regexp");
+    const QCommandLineOption backendOpt("backend",
+                                        "Process only the specified backend. Can be repeated.",
+                                        "name");
+    const QCommandLineOption viewSizeOpt("view-size", "Image width in pixels.", "px");
+    const QCommandLineOption jobsOpt(QStringList({ "j", "jobs" }),
+                                     "Number of tests processed in parallel.", "n");
+    const QCommandLineOption noCacheOpt("no-cache", "Do not reuse previous renders.");
+    const QCommandLineOption classifyOpt("classify",
+                                         "Set the state of unreviewed results that are clearly "
+                                         "passed or failed.");
+    const QCommandLineOption regressionOpt("regression",
+                                           "Compare renders with the previous converter version "
+                                           "and reset the results that have changed.");
+    const QCommandLineOption toleranceOpt("tolerance",
+                                          "The largest channel difference of an unchanged render "
+                                          "in the regression mode.", "delta", "0");
+    const QCommandLineOption shardsOpt("shards",
+                                       "Split the tests between the number of worker processes.",
+                                       "n");
+    const QCommandLineOption shardByOpt("shard-by",
+                                        "Split the tests by `group` directory or by `hash`.",
+                                        "mode", "group");
+    const QCommandLineOption spoolOpt("spool",
+                                      "Directory shared with the workers, "
+                                      "<output>/spool by default.", "dir");
+    const QCommandLineOption workerOpt("worker",
+                                       "Process the shards queued in the spool directory "
+                                       "of a sharded run, possibly on another host.", "dir");
+    const QCommandLineOption shareOpt("share",
+                                      "Use 1/n of the cores, Java jobs and memory budget. "
+                                      "Set for the local workers of a sharded run.", "n", "1");
+    parser.addOptions({ batchOpt, outOpt, filterOpt, backendOpt, viewSizeOpt, jobsOpt,
+                        noCacheOpt, classifyOpt, regressionOpt, toleranceOpt,
+                        shardsOpt, shardByOpt, spoolOpt, workerOpt, shareOpt });
+    parser.process(a);
+
+    Batch::Options opt;
+    opt.outDir = parser.value(outOpt);
+    opt.filter = parser.value(filterOpt);
+    opt.viewSize = parser.value(viewSizeOpt).toInt();
+    opt.jobs = parser.value(jobsOpt).toInt();
+    opt.classify = parser.isSet(classifyOpt);
+    opt.regression = parser.isSet(regressionOpt);
+    opt.tolerance = parser.value(toleranceOpt).toInt();
+    opt.shards = parser.value(shardsOpt).toInt();
+    opt.shardBy = parser.value(shardByOpt);
+    opt.spoolDir = parser.value(spoolOpt);
+    opt.workerDir = parser.value(workerOpt);
+    opt.share = qMax(1, parser.value(shareOpt).toInt());
+
+    if (opt.shardBy != "group" && opt.shardBy != "hash") {
+        qCritical().noquote() << QString("Unknown shard mode: %1").arg(opt.shardBy);
+        return 1;
+    }
+
+    for (const auto &name : parser.values(backendOpt)) {
+        bool isFound = false;
+        for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+            if (backendToString((Backend)t).compare(name, Qt::CaseInsensitive) == 0) {
+                opt.backends << (Backend)t;
+                isFound = true;
+            }
+        }
+
+        if (!isFound) {
+            qCritical().noquote() << QString("Unknown backend: %1").arg(name);
+            return 1;
+        }
+    }
+
+    Settings settings;
+    settings.load();
+
+    if (parser.isSet(noCacheOpt)) {
+        settings.useRenderCache = false;
+    }
+    RenderCache::setMaxSize(qint64(settings.renderCacheSize) * 1024 * 1024);
+
+    const int code = Batch::run(settings, opt);
+
+    RenderServer::shutdown();
+    RenderHistory::save();
+    TestIndex::save();
+
+    return code;
+}
 
 int main(int argc, char *argv[])
 {
+    if (isBatchMode(argc, argv)) {
+        return runBatch(argc, argv);
+    }
+
     QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
 
     QApplication a(argc, argv);
@@ -13,5 +143,11 @@ int main(int argc, char *argv[])
     MainWindow w;
     w.show();
 
-    return a.exec();
+    const int code = a.exec();
+
+    RenderServer::shutdown();
+    RenderHistory::save();
+    TestIndex::save();
+
+    return code;
 }
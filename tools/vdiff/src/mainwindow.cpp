@@ -1,18 +1,24 @@
+#include <QDebug>
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QMessageBox>
-#include <QPainter>
+#include <QProgressDialog>
 #include <QScreen>
 #include <QScrollBar>
 #include <QShortcut>
 #include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "exportdialog.h"
 #include "backendwidget.h"
 #include "paths.h"
 #include "process.h"
+#include "referencestore.h"
+#include "rendercache.h"
+#include "scheduler.h"
 #include "settingsdialog.h"
+#include "sheet.h"
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
@@ -20,11 +26,12 @@
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , m_autosaveTimer(new QTimer(this))
 {
     ui->setupUi(this);
 
     m_settings.load();
+    RenderCache::setMaxSize(qint64(m_settings.renderCacheSize) * 1024 * 1024);
+    Scheduler::instance().configure(m_settings);
 
     m_render.setSettings(&m_settings);
     m_render.setScale(qApp->screens().first()->devicePixelRatio());
@@ -34,16 +41,17 @@ MainWindow::MainWindow(QWidget *parent)
     connect(&m_render, &Render::imageReady, this, &MainWindow::onImageReady);
     connect(&m_render, &Render::diffReady, this, &MainWindow::onDiffReady);
     connect(&m_render, &Render::finished, this, &MainWindow::onRenderFinished);
-
-    connect(m_autosaveTimer, &QTimer::timeout, this, &MainWindow::save);
-    m_autosaveTimer->setInterval(30000); // 30 sec
-    m_autosaveTimer->start();
+    connect(&m_referencesWatcher, &QFutureWatcher<void>::finished, this, [this]() {
+        if (m_referencesOutdated) {
+            updateReferences();
+        }
+    });
 
     auto shortcutReload = new QShortcut(QKeySequence("Ctrl+R"), this);
     connect(shortcutReload, &QShortcut::activated, [this]() {
         const auto idx = ui->cmbBoxFiles->currentIndex();
         if (idx >= 0) {
-            loadTest(idx);
+            loadTest(idx, false);
         }
     });
 
@@ -55,6 +63,22 @@ MainWindow::MainWindow(QWidget *parent)
         }
     });
 
+    // Ambiguous results are the only ones left after the automatic classification.
+    auto shortcutReview = new QShortcut(QKeySequence("Ctrl+U"), this);
+    connect(shortcutReview, &QShortcut::activated, [this]() {
+        for (int i = ui->cmbBoxFiles->currentIndex() + 1; i < m_tests.size(); ++i) {
+            const auto &item = m_tests.at(i);
+            for (auto *w : m_backendWidges.values()) {
+                if (   w->backend() != Backend::Reference
+                    && item.state.value(w->backend()) == TestState::Unknown)
+                {
+                    ui->cmbBoxFiles->setCurrentIndex(i);
+                    return;
+                }
+            }
+        }
+    });
+
     // TODO: check that convertors exists
 
     QTimer::singleShot(5, this, &MainWindow::onStart);
@@ -62,7 +86,11 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
-    save();
+    try {
+        save();
+    } catch (const QString &msg) {
+        qWarning().noquote() << msg;
+    }
 
     delete ui;
 }
@@ -130,12 +158,13 @@ void MainWindow::prepareBackends()
     });
 }
 
+// The tests list stays enabled, since switching a test cancels the current render.
 void MainWindow::setGuiEnabled(bool flag)
 {
     ui->btnSettings->setEnabled(flag);
     ui->btnSync->setEnabled(flag);
     ui->btnPrint->setEnabled(flag);
-    ui->cmbBoxFiles->setEnabled(flag);
+    ui->btnExport->setEnabled(flag);
     for (auto *w : m_backendWidges.values()) {
         w->setEnabled(flag);
     }
@@ -163,12 +192,19 @@ void MainWindow::loadImageList(const TestSuite prevSuite)
             m_tests = Tests::load(m_settings.testSuite, m_settings.resultsPath(),
                                   m_settings.testsPath());
         }
+
+        m_results.reset(new ResultsStore(m_settings.resultsPath()));
     } catch (const QString &msg) {
+        // States must not be written into the previous suite's results.
+        m_tests = Tests();
+        m_results.reset();
+        ui->cmbBoxFiles->blockSignals(false);
+
         QMessageBox::critical(this, "Error", msg);
         qApp->quit();
+        return;
     }
 
-
     for (const TestItem &item : m_tests) {
         QString title;
         if (m_settings.testSuite == TestSuite::Own) {
@@ -198,6 +234,30 @@ void MainWindow::loadImageList(const TestSuite prevSuite)
 
     ui->cmbBoxFiles->blockSignals(false);
     ui->cmbBoxFiles->setFocus();
+
+    updateReferences();
+}
+
+// References that are not in the store yet are decoded on each view,
+// until the store is updated in background.
+void MainWindow::updateReferences()
+{
+    if (m_referencesWatcher.isRunning()) {
+        m_referencesOutdated = true;
+        return;
+    }
+
+    m_referencesOutdated = false;
+
+    const auto testsPath = m_settings.testsPath();
+    const int viewSize = m_render.viewSize();
+    m_referencesWatcher.setFuture(QtConcurrent::run([testsPath, viewSize]() {
+        try {
+            ReferenceStore::build(testsPath, viewSize);
+        } catch (const QString &msg) {
+            qWarning().noquote() << msg;
+        }
+    }));
 }
 
 void MainWindow::on_cmbBoxFiles_currentIndexChanged(int idx)
@@ -205,7 +265,7 @@ void MainWindow::on_cmbBoxFiles_currentIndexChanged(int idx)
     loadTest(idx);
 }
 
-void MainWindow::loadTest(const int idx)
+void MainWindow::loadTest(const int idx, const bool useCache)
 {
     const auto path = m_tests.at(idx).path;
 
@@ -213,7 +273,13 @@ void MainWindow::loadTest(const int idx)
     resetImages();
     fillChBoxes();
 
-    m_render.render(path);
+    m_render.render(path, useCache);
+
+    QStringList nextPaths;
+    for (int i = idx + 1; i < m_tests.size() && nextPaths.size() < m_settings.prefetchCount; ++i) {
+        nextPaths << m_tests.at(i).path;
+    }
+    m_render.prefetch(nextPaths);
 
     setGuiEnabled(false);
 }
@@ -239,19 +305,33 @@ void MainWindow::fillChBoxes()
     }
 }
 
+// States are stored as soon as they are changed, the CSV is only an export.
 void MainWindow::save()
 {
-    m_tests.save(m_settings.resultsPath());
+    if (m_results) {
+        m_results->exportCsv();
+    }
 }
 
 void MainWindow::updatePassFlags()
 {
+    if (!m_results) {
+        return;
+    }
+
     try {
         const auto idx = ui->cmbBoxFiles->currentIndex();
         auto &item = m_tests.at(idx);
 
         for (auto *w : m_backendWidges.values()) {
-            item.state.insert(w->backend(), w->testState());
+            if (w->backend() == Backend::Reference) {
+                continue;
+            }
+
+            if (item.state.value(w->backend()) != w->testState()) {
+                item.state.insert(w->backend(), w->testState());
+                m_results->setState(item.baseName, w->backend(), w->testState());
+            }
         }
     } catch (const QString &msg) {
         QMessageBox::critical(this, "Error", msg);
@@ -265,18 +345,45 @@ void MainWindow::resetImages()
     }
 }
 
-void MainWindow::onImageReady(const Backend type, const QImage &img)
+void MainWindow::onImageReady(const Backend type, const QImage &img, const JobStats &stats)
 {
     Q_ASSERT(!img.isNull());
 
+    // A render of the previous suite, which failed to load.
+    if (ui->cmbBoxFiles->currentIndex() == -1) {
+        return;
+    }
+
     const auto view = m_backendWidges.value(type);
     view->setImage(img);
+    view->setRenderStats(stats);
+
+    const auto &item = m_tests.at(ui->cmbBoxFiles->currentIndex());
+    TimingsLog::append(m_settings.timingsPath(), item.baseName, type, "render", stats);
 }
 
-void MainWindow::onDiffReady(const Backend type, const QImage &img)
+void MainWindow::onDiffReady(const DiffOutput &diff, const TestState verdict)
 {
-    const auto view = m_backendWidges.value(type);
-    view->setDiffImage(img);
+    if (ui->cmbBoxFiles->currentIndex() == -1) {
+        return;
+    }
+
+    const auto view = m_backendWidges.value(diff.type);
+    view->setDiffImage(diff.img);
+    view->setDiffStats(diff.stats);
+    view->setDiffMetrics(diff.metrics, verdict);
+
+    const auto &item = m_tests.at(ui->cmbBoxFiles->currentIndex());
+    TimingsLog::append(m_settings.timingsPath(), item.baseName, diff.type, "diff", diff.stats);
+
+    // Only unreviewed results are classified, a manually set state always wins.
+    if (   m_settings.autoClassify
+        && verdict != TestState::Unknown
+        && item.state.value(diff.type) == TestState::Unknown)
+    {
+        view->setTestState(verdict);
+        updatePassFlags();
+    }
 }
 
 void MainWindow::onRenderFinished()
@@ -302,10 +409,29 @@ void MainWindow::on_btnSync_clicked()
     }
 
     try {
-        Tests::resync(m_settings);
+        const auto report = Tests::resync(m_settings);
         loadImageList(m_settings.testSuite);
 
-        QMessageBox::information(this, "Info", "Tests was successfully synced.");
+        QStringList details;
+        for (const auto &name : report.added) {
+            details << "+ " + name;
+        }
+        for (const auto &name : report.removed) {
+            details << "- " + name;
+        }
+        for (const auto &names : report.renamed) {
+            details << QString("%1 -> %2").arg(names.first, names.second);
+        }
+
+        QMessageBox msgBox(QMessageBox::Information, "Info",
+                           QString("Tests was successfully synced.\n\n"
+                                   "Added: %1\nRemoved: %2\nRenamed: %3")
+                           .arg(report.added.size())
+                           .arg(report.removed.size())
+                           .arg(report.renamed.size()),
+                           QMessageBox::Ok, this);
+        msgBox.setDetailedText(details.join('\n'));
+        msgBox.exec();
     } catch (const QString &msg) {
         QMessageBox::critical(this, "Error", msg);
     }
@@ -313,16 +439,20 @@ void MainWindow::on_btnSync_clicked()
 
 void MainWindow::on_btnSettings_clicked()
 {
-    // Save in case of any changes.
-    save();
+    // Export in case the suite will be changed.
+    try {
+        save();
+    } catch (const QString &msg) {
+        QMessageBox::critical(this, "Error", msg);
+    }
 
     const auto prevSuite = m_settings.testSuite;
 
     SettingsDialog diag(&m_settings, this);
     if (diag.exec()) {
-        m_autosaveTimer->stop();
-
         m_render.setScale(qApp->screens().first()->devicePixelRatio());
+        RenderCache::setMaxSize(qint64(m_settings.renderCacheSize) * 1024 * 1024);
+        Scheduler::instance().configure(m_settings);
 
         for (auto *w : m_backendWidges.values()) {
             w->setViewSize(QSize(m_settings.viewSize, m_settings.viewSize));
@@ -330,13 +460,12 @@ void MainWindow::on_btnSettings_clicked()
 
         prepareBackends();
         loadImageList(prevSuite);
-        m_autosaveTimer->start();
     }
 }
 
 void MainWindow::on_btnPrint_clicked()
 {
-    ExportDialog diag(m_backendWidges.keys(), this);
+    ExportDialog diag(m_backendWidges.keys(), false, this);
     if (!diag.exec()) {
         return;
     }
@@ -348,83 +477,103 @@ void MainWindow::on_btnPrint_clicked()
         return;
     }
 
-    const int backends = opt.backends.size();
-    const int scale = (int)qApp->screens().first()->devicePixelRatio();
-    const int titleHeight = 20;
-    const int spacing = 5;
-    const int testTitleHeight = fontMetrics().height() * 2;
-    const int fullWidth = m_settings.viewSize * backends + spacing * (backends + 1);
-    int fullHeight = titleHeight + m_settings.viewSize + spacing * 2;
+    QVector<Sheet::Column> columns;
+    for (const auto backend : opt.backends) {
+        if (!m_backendWidges.contains(backend)) {
+            continue;
+        }
 
-    if (opt.showTitle) {
-        fullHeight += testTitleHeight;
+        const auto w = m_backendWidges.value(backend);
+        columns.append({ w->title(), w->image(), w->diffImage(), w->testState() });
     }
 
-    if (opt.showDiff) {
-        fullHeight += spacing + m_settings.viewSize;
+    const auto &item = m_tests.at(ui->cmbBoxFiles->currentIndex());
+    const int scale = (int)qApp->screens().first()->devicePixelRatio();
+    const auto image = Sheet::paint(item.baseName, columns, opt, m_settings.viewSize, scale);
+
+    const auto path = QFileDialog::getSaveFileName(this, tr("Save As"),
+                                                   QDir::homePath() + "/" + Sheet::fileName(item),
+                                                   tr("Images (*.png)"));
+    if (!path.isEmpty()) {
+        image.save(path);
     }
+}
 
-    QImage image(fullWidth * scale, fullHeight * scale, QImage::Format_ARGB32);
-    image.fill(Qt::white);
-    image.setDevicePixelRatio(scale);
+// Sheets are built off the GUI thread, so the dialog stays responsive.
+void MainWindow::on_btnExport_clicked()
+{
+    ExportDialog diag(m_backendWidges.keys(), true, this);
+    if (!diag.exec()) {
+        return;
+    }
 
-    QPainter p(&image);
+    const auto opt = diag.options();
 
-    if (opt.showTitle) {
-        const auto idx = ui->cmbBoxFiles->currentIndex();
-        const QRect textRect(0, 0, fullWidth, testTitleHeight);
-        p.setFont(QFont("Arial", 14));
-        p.drawText(textRect, Qt::AlignCenter, "Test file: " + m_tests.at(idx).baseName);
-        p.translate(0, testTitleHeight);
+    if (opt.backends.isEmpty()) {
+        QMessageBox::warning(this, tr("Error"), tr("At least one backend should be selected."));
+        return;
     }
 
-    p.setFont(QFont("Arial", 12));
-
-    int x = spacing;
-    int y = spacing;
-    for (const auto backend : opt.backends) {
-        if (!m_backendWidges.contains(backend)) {
-            continue;
+    QVector<TestItem> tests;
+    for (const auto &item : m_tests) {
+        if (   opt.filterStates.isEmpty()
+            || opt.filterStates.contains(item.state.value(opt.filterBackend)))
+        {
+            tests << item;
         }
+    }
 
-        auto w = m_backendWidges.value(backend);
-        const auto title = w->title();
-
-        const auto textRect = QRect(x, y, m_settings.viewSize, titleHeight - 3);
-        p.setPen(Qt::black);
-        p.drawText(textRect, Qt::AlignCenter, title);
+    if (tests.isEmpty()) {
+        QMessageBox::information(this, tr("Export"), tr("No tests match the filter."));
+        return;
+    }
 
-        auto img = w->image();
-        p.drawImage(x, y + titleHeight, img);
+    const auto dir = QFileDialog::getExistingDirectory(this, tr("Export To"), QDir::homePath());
+    if (dir.isEmpty()) {
+        return;
+    }
 
-        if (opt.indicateStatus) {
-            switch (w->testState()) {
-                case TestState::Unknown : p.setPen(Qt::gray); break;
-                case TestState::Passed  : p.setPen(Qt::green); break;
-                case TestState::Failed  : p.setPen(Qt::red); break;
-                case TestState::Crashed : p.setPen(Qt::yellow); break;
-            }
+    QHash<Backend, QString> titles;
+    for (const auto *w : m_backendWidges) {
+        titles.insert(w->backend(), w->title());
+    }
 
-            p.drawRect(x, y + titleHeight, img.width() / scale, img.height() / scale);
-        }
+    const int scale = (int)qApp->screens().first()->devicePixelRatio();
+    const auto cancel = QSharedPointer<QAtomicInt>::create(0);
+    const auto future = Sheet::exportAll(m_settings, tests, titles, opt, dir, scale, cancel);
+
+    auto progress = new QProgressDialog(tr("Exporting sheets..."), tr("Cancel"),
+                                        0, tests.size(), this);
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setMinimumDuration(0);
+    progress->setAutoClose(false);
+
+    auto watcher = new QFutureWatcher<QString>(progress);
+    connect(watcher, &QFutureWatcher<QString>::progressValueChanged,
+            progress, &QProgressDialog::setValue);
+    connect(progress, &QProgressDialog::canceled, watcher, [watcher, cancel]() {
+        cancel->testAndSetRelease(0, 1);
+        watcher->cancel();
+    });
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, progress]() {
+        progress->deleteLater();
 
-        if (opt.showDiff) {
-            p.drawImage(x, y + titleHeight + m_settings.viewSize + spacing, w->diffImage());
+        QStringList errors;
+        for (const auto &error : watcher->future().results()) {
+            if (!error.isEmpty()) {
+                errors << error;
+            }
         }
 
-        x += m_settings.viewSize + spacing;
-    }
-
-    p.end();
-
-    const auto idx = ui->cmbBoxFiles->currentIndex();
-    const auto &item = m_tests.at(idx);
-    const QString fileName = QFileInfo(item.path).completeBaseName() + ".png";
+        if (!errors.isEmpty()) {
+            const int maxErrors = 10;
+            auto msg = QStringList(errors.mid(0, maxErrors)).join('\n');
+            if (errors.size() > maxErrors) {
+                msg += tr("\nAnd %1 more.").arg(errors.size() - maxErrors);
+            }
 
-    const auto path = QFileDialog::getSaveFileName(this, tr("Save As"),
-                                                   QDir::homePath() + "/" + fileName,
-                                                   tr("Images (*.png)"));
-    if (!path.isEmpty()) {
-        image.save(path);
-    }
+            QMessageBox::warning(this, tr("Export"), msg);
+        }
+    });
+    watcher->setFuture(future);
 }
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <QFutureWatcher>
 #include <QMainWindow>
+#include <QScopedPointer>
 
 #include "settings.h"
 #include "tests.h"
 #include "render.h"
+#include "resultsstore.h"
 
 namespace Ui {
 class MainWindow;
@@ -28,29 +31,33 @@ private:
     void setGuiEnabled(bool flag);
     void loadImageList(const TestSuite prevSuite);
     void resetImages();
-    void loadTest(const int idx);
+    void loadTest(const int idx, const bool useCache = true);
     void setAnimationEnabled(bool flag);
     void fillChBoxes();
     void save();
+    void updateReferences();
 
 private slots:
     void onStart();
     void on_cmbBoxFiles_currentIndexChanged(int idx);
-    void onImageReady(const Backend type, const QImage &img);
-    void onDiffReady(const Backend type, const QImage &img);
+    void onImageReady(const Backend type, const QImage &img, const JobStats &stats);
+    void onDiffReady(const DiffOutput &diff, const TestState verdict);
     void onRenderFinished();
     void updatePassFlags();
     void on_btnSync_clicked();
     void on_btnSettings_clicked();
     void on_btnPrint_clicked();
+    void on_btnExport_clicked();
 
 private:
     Ui::MainWindow * const ui;
-    QTimer * const m_autosaveTimer;
 
     QHash<Backend, BackendWidget*> m_backendWidges;
 
     Settings m_settings;
     Tests m_tests;
+    QScopedPointer<ResultsStore> m_results;
     Render m_render;
+    QFutureWatcher<void> m_referencesWatcher;
+    bool m_referencesOutdated = false;
 };
@@ -1,4 +1,6 @@
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QFile>
 #include <QFileInfo>
 
 #include "paths.h"
@@ -11,3 +13,15 @@ QString Paths::workDir() noexcept
     return qApp->applicationDirPath();
 #endif
 }
+
+QByteArray Paths::fileHash(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&file);
+    return hash.result();
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <QByteArray>
 #include <QString>
 
 namespace Paths {
     QString workDir() noexcept;
+
+    // SHA-1 of the file content, empty when the file can't be read.
+    QByteArray fileHash(const QString &path);
 };
@@ -1,36 +1,345 @@
+#include <QElapsedTimer>
 #include <QProcess>
 
+#ifdef Q_OS_UNIX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#include "jobstats.h"
+
 #include "process.h"
 
-QByteArray Process::run(const QString &name, const QStringList &args,
-                        bool mergeChannels, int validExitCodes)
+// Of the memory limit and the cancellation.
+static const int CheckInterval = 100; // ms
+
+static bool isCanceled(const ProcessLimits &limits)
 {
-    QProcess proc;
-    if (mergeChannels) {
-        proc.setProcessChannelMode(QProcess::MergedChannels);
+    return limits.cancel && limits.cancel->loadAcquire() != 0;
+}
+
+#ifdef Q_OS_UNIX
+namespace {
+
+enum class Kill
+{
+    None,
+    Timeout,
+    Memory,
+    Canceled,
+};
+
+}
+
+static void setFailure(JobStats *stats, const QString &reason)
+{
+    if (stats) {
+        stats->failure = reason;
+    }
+}
+
+#ifdef Q_OS_LINUX
+// Converters are single JVM processes, so only the child itself is checked.
+// Returns -1 when unknown.
+static qint64 residentMemory(pid_t pid)
+{
+    char path[32];
+    ::snprintf(path, sizeof(path), "/proc/%d/statm", int(pid));
+
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char buf[128];
+    const auto len = ::read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+
+    buf[len] = 0;
+
+    long long pages = 0;
+    if (::sscanf(buf, "%*s %lld", &pages) != 1) {
+        return -1;
     }
 
-    proc.start(name, args);
+    return qint64(pages) * ::sysconf(_SC_PAGESIZE);
+}
+#endif
 
+// QProcess reaps its children by itself, so rusage of a child is only available
+// when it was started and waited for directly. The same goes for killing a process group.
+static QByteArray runDirect(const QString &name, const QStringList &args,
+                            bool mergeChannels, const ProcessLimits &limits,
+                            int *exitCode, JobStats *stats)
+{
     const QString fullCmd = name + " " + args.join(" ");
 
-    if (!proc.waitForStarted()) {
+    StageTimer timer(stats);
+
+    int fds[2];
+#ifdef Q_OS_LINUX
+    if (::pipe2(fds, O_CLOEXEC) != 0) {
+#else
+    if (::pipe(fds) != 0 || ::fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0
+        || ::fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0) {
+#endif
         throw QString("Process '%1' failed to start.").arg(fullCmd);
     }
 
-    if (!proc.waitForFinished(120000)) { // 2min
-        throw QString("Process '%1' was shutdown by timeout.").arg(fullCmd);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    if (mergeChannels) {
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    // A new process group, so processes started by the child are killed with it.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    QVector<QByteArray> argData;
+    argData << name.toLocal8Bit();
+    for (const auto &arg : args) {
+        argData << arg.toLocal8Bit();
+    }
+
+    QVector<char*> argv;
+    for (auto &arg : argData) {
+        argv << arg.data();
     }
+    argv << nullptr;
 
-    const QByteArray output = proc.readAll();
+    pid_t pid = 0;
+    const int res = ::posix_spawnp(&pid, argData.first().constData(), &actions, &attr,
+                                   argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(fds[1]);
 
-    if (proc.exitCode() != 0 && proc.exitCode() != validExitCodes) {
-        throw QString("Process '%1' finished with an invalid exit code: %2\n%3")
-                .arg(name).arg(proc.exitCode()).arg(QString(output));
+    if (res != 0) {
+        ::close(fds[0]);
+        throw QString("Process '%1' failed to start.").arg(fullCmd);
+    }
+
+#ifdef Q_OS_LINUX
+    // posix_spawn can't set limits of a child, but the child is still starting a JVM by now.
+    // The soft limit sends SIGXCPU and the hard one SIGKILL.
+    if (limits.cpuTime > 0) {
+        const rlimit cpu { rlim_t(limits.cpuTime), rlim_t(limits.cpuTime) + 5 };
+        ::prlimit(pid, RLIMIT_CPU, &cpu, nullptr);
+    }
+#endif
+
+    timer.lap("spawn");
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QByteArray output;
+    Kill killReason = Kill::None;
+    while (true) {
+        const auto left = limits.timeout - elapsed.elapsed();
+        if (left <= 0) {
+            killReason = Kill::Timeout;
+            break;
+        }
+
+        int wait = int(left);
+        if (limits.cancel) {
+            if (isCanceled(limits)) {
+                killReason = Kill::Canceled;
+                break;
+            }
+
+            wait = qMin(wait, CheckInterval);
+        }
+
+#ifdef Q_OS_LINUX
+        if (limits.memory > 0) {
+            if (residentMemory(pid) > limits.memory) {
+                killReason = Kill::Memory;
+                break;
+            }
+
+            wait = qMin(wait, CheckInterval);
+        }
+#endif
+
+        pollfd pfd { fds[0], POLLIN, 0 };
+        const int n = ::poll(&pfd, 1, wait);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            break;
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        char buf[4096];
+        const auto len = ::read(fds[0], buf, sizeof(buf));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len <= 0) {
+            break;
+        }
+
+        output.append(buf, int(len));
+    }
+
+    ::close(fds[0]);
+
+    if (killReason != Kill::None) {
+        ::kill(-pid, SIGKILL);
+    }
+
+    int status = 0;
+    rusage usage;
+    while (::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+
+    timer.lap("process");
+
+    const qint64 cpuTime = qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+                           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    if (stats) {
+        stats->cpuTime = cpuTime;
+#ifdef Q_OS_MACOS
+        stats->peakRss = usage.ru_maxrss / 1024; // bytes
+#else
+        stats->peakRss = usage.ru_maxrss; // KiB
+#endif
+    }
+
+    if (killReason == Kill::Timeout) {
+        setFailure(stats, "timeout");
+        throw QString("Process '%1' was shutdown by timeout of %2 s.")
+                .arg(fullCmd).arg(limits.timeout / 1000.0);
+    }
+
+    if (killReason == Kill::Canceled) {
+        setFailure(stats, "canceled");
+        throw QString("Process '%1' was canceled.").arg(fullCmd);
+    }
+
+    if (killReason == Kill::Memory) {
+        setFailure(stats, "memory");
+        throw QString("Process '%1' was killed after exceeding the memory limit of %2 MiB.")
+                .arg(fullCmd).arg(limits.memory / 1024 / 1024);
+    }
+
+    if (WIFSIGNALED(status)) {
+        const int sig = WTERMSIG(status);
+        const bool isCpuLimit = limits.cpuTime > 0 && cpuTime >= qint64(limits.cpuTime) * 1000000;
+        if (sig == SIGXCPU || (sig == SIGKILL && isCpuLimit)) {
+            setFailure(stats, "cpu");
+            throw QString("Process '%1' was killed after exceeding the CPU time limit of %2 s.")
+                    .arg(fullCmd).arg(limits.cpuTime);
+        }
+
+        if (sig == SIGKILL) {
+            setFailure(stats, "killed");
+            throw QString("Process '%1' was killed, likely by the system on out of memory:\n%2")
+                    .arg(name).arg(QString(output));
+        }
+
+        setFailure(stats, QString("signal %1").arg(sig));
+        throw QString("Process '%1' was crashed by signal %2:\n%3")
+                .arg(name).arg(sig).arg(QString(output));
     }
 
-    if (proc.exitStatus() != QProcess::NormalExit) {
-        throw QString("Process '%1' was crashed:\n%2").arg(name).arg(QString(output));
+    *exitCode = WEXITSTATUS(status);
+
+    return output;
+}
+#endif
+
+QByteArray Process::run(const QString &name, const QStringList &args,
+                        bool mergeChannels, int validExitCodes, JobStats *stats,
+                        const ProcessLimits &limits)
+{
+    QByteArray output;
+    int exitCode = 0;
+
+#ifdef Q_OS_UNIX
+    output = runDirect(name, args, mergeChannels, limits, &exitCode, stats);
+#else
+    {
+        StageTimer timer(stats);
+
+        QProcess proc;
+        if (mergeChannels) {
+            proc.setProcessChannelMode(QProcess::MergedChannels);
+        }
+
+        proc.start(name, args);
+
+        const QString fullCmd = name + " " + args.join(" ");
+
+        if (!proc.waitForStarted()) {
+            throw QString("Process '%1' failed to start.").arg(fullCmd);
+        }
+
+        timer.lap("spawn");
+
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (!proc.waitForFinished(CheckInterval)) {
+            const bool isTimedOut = elapsed.elapsed() > limits.timeout;
+            if (!isTimedOut && !isCanceled(limits)) {
+                continue;
+            }
+
+            proc.kill();
+            proc.waitForFinished();
+
+            if (stats) {
+                stats->failure = isTimedOut ? "timeout" : "canceled";
+            }
+
+            if (isTimedOut) {
+                throw QString("Process '%1' was shutdown by timeout of %2 s.")
+                        .arg(fullCmd).arg(limits.timeout / 1000.0);
+            }
+
+            throw QString("Process '%1' was canceled.").arg(fullCmd);
+        }
+
+        timer.lap("process");
+
+        output = proc.readAll();
+        exitCode = proc.exitCode();
+
+        if (proc.exitStatus() != QProcess::NormalExit) {
+            throw QString("Process '%1' was crashed:\n%2").arg(name).arg(QString(output));
+        }
+    }
+#endif
+
+    if (exitCode != 0 && exitCode != validExitCodes) {
+        throw QString("Process '%1' finished with an invalid exit code: %2\n%3")
+                .arg(name).arg(exitCode).arg(QString(output));
     }
 
     return output;
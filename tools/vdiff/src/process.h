@@ -1,11 +1,32 @@
 #pragma once
 
+#include <QAtomicInt>
 #include <QString>
 
+struct JobStats;
+
+// Resource limits of a single process.
+struct ProcessLimits
+{
+    int timeout = 120000; // Wall time in ms.
+    int cpuTime = 0; // CPU time of all threads in s, 0 when unlimited.
+    qint64 memory = 0; // Resident memory in bytes, 0 when unlimited.
+    const QAtomicInt *cancel = nullptr; // Optional. Kills the process once set.
+};
+
 class Process
 {
 public:
+    // When `stats` is set, records the spawn and run time of the process
+    // and, on Unix, its CPU time and peak RSS.
+    //
+    // On Unix, the process runs in its own process group, which is killed as a whole
+    // once a limit is exceeded or it's canceled.
+    // The CPU time and memory limits are enforced on Linux only.
+    // The reason of a kill is set to `JobStats::failure`.
     static QByteArray run(const QString &name, const QStringList &args,
                           bool mergeChannels = false,
-                          int validExitCode = 0);
+                          int validExitCode = 0,
+                          JobStats *stats = nullptr,
+                          const ProcessLimits &limits = ProcessLimits());
 };
@@ -0,0 +1,407 @@
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include "jobstats.h"
+#include "paths.h"
+
+#include "referencestore.h"
+
+namespace {
+
+struct Entry
+{
+    qint64 size; // Of the PNG.
+    qint64 mtime; // Of the PNG, in ms.
+    qint32 width;
+    qint32 height;
+    quint64 offset;
+};
+
+QDataStream& operator<<(QDataStream &s, const Entry &e)
+{
+    return s << e.size << e.mtime << e.width << e.height << e.offset;
+}
+
+QDataStream& operator>>(QDataStream &s, Entry &e)
+{
+    return s >> e.size >> e.mtime >> e.width >> e.height >> e.offset;
+}
+
+struct Mapping
+{
+    QFile file;
+    QString name; // Of the blob file.
+    uchar *data = nullptr;
+    qint64 size = 0;
+    QHash<QString, Entry> index; // Absolute PNG path -> entry.
+
+    ~Mapping()
+    {
+        if (data) {
+            file.unmap(data);
+        }
+    }
+};
+
+typedef QSharedPointer<Mapping> MappingPtr;
+
+struct Source
+{
+    qint64 size;
+    qint64 mtime;
+    bool isReused; // Unchanged since the previous build.
+};
+
+struct DecodeReference
+{
+    typedef QImage result_type;
+
+    const int viewSize;
+
+    QImage operator()(const QString &path) const
+    {
+        try {
+            return ReferenceStore::decode(path, viewSize);
+        } catch (const QString &msg) {
+            qWarning().noquote() << msg;
+            return QImage();
+        }
+    }
+};
+
+QMutex g_mutex;
+QHash<int, MappingPtr> g_stores; // View size -> store.
+
+}
+
+static const quint32 StoreMagic = 0x76726566; // vref
+static const quint32 StoreVersion = 1;
+
+// The header is padded to it and so are the pixels of each entry.
+static const int Alignment = 64;
+
+static QString storeDir()
+{
+    return Paths::workDir() + "/reference-store";
+}
+
+// Contains the file name of the current blob of a view size.
+// Each build writes a new blob, since a mapped file can't be replaced on Windows.
+static QString pointerPath(const int viewSize)
+{
+    return QString("%1/%2.current").arg(storeDir()).arg(viewSize);
+}
+
+static QString currentBlob(const int viewSize)
+{
+    QFile file(pointerPath(viewSize));
+    if (!file.open(QFile::ReadOnly)) {
+        return QString();
+    }
+
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+// Blobs that are still mapped can't be removed on Windows, they are retried by the next build.
+static void removeOldBlobs(const int viewSize, const QString &current)
+{
+    const QDir dir(storeDir());
+    const QString prefix = QString("%1-").arg(viewSize);
+    for (const auto &name : dir.entryList({ prefix + "*.blob" }, QDir::Files)) {
+        if (name != current) {
+            QFile::remove(dir.absoluteFilePath(name));
+        }
+    }
+}
+
+static qint64 mtime(const QFileInfo &fi)
+{
+    return fi.lastModified().toMSecsSinceEpoch();
+}
+
+static qint64 pixelsSize(const Entry &e)
+{
+    return qint64(e.width) * e.height * 4;
+}
+
+static qint64 aligned(const qint64 n)
+{
+    return (n + Alignment - 1) / Alignment * Alignment;
+}
+
+// Returns null when the store is missing or invalid.
+static MappingPtr openStore(const QString &name, const int viewSize)
+{
+    MappingPtr store(new Mapping);
+    store->name = name;
+    store->file.setFileName(storeDir() + "/" + name);
+    if (!store->file.open(QFile::ReadOnly)) {
+        return MappingPtr();
+    }
+
+    store->size = store->file.size();
+    if (store->size < Alignment) {
+        return MappingPtr();
+    }
+
+    store->data = store->file.map(0, store->size);
+    if (!store->data) {
+        return MappingPtr();
+    }
+
+    const char *data = (const char*)store->data;
+
+    QDataStream header(QByteArray::fromRawData(data, Alignment));
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 size = 0;
+    quint64 indexOffset = 0;
+    quint64 indexSize = 0;
+    header >> magic >> version >> size >> indexOffset >> indexSize;
+    if (   magic != StoreMagic
+        || version != StoreVersion
+        || size != quint32(viewSize)
+        || indexOffset < quint64(Alignment)
+        || indexOffset + indexSize > quint64(store->size))
+    {
+        return MappingPtr();
+    }
+
+    QDataStream stream(QByteArray::fromRawData(data + indexOffset, int(indexSize)));
+    stream >> store->index;
+    if (stream.status() != QDataStream::Ok) {
+        return MappingPtr();
+    }
+
+    for (const auto &e : store->index) {
+        if (e.offset < quint64(Alignment) || e.offset + pixelsSize(e) > indexOffset) {
+            return MappingPtr();
+        }
+    }
+
+    return store;
+}
+
+// The store is remapped when it was rebuilt by this or another process.
+static MappingPtr currentStore(const int viewSize)
+{
+    const auto name = currentBlob(viewSize);
+
+    QMutexLocker lock(&g_mutex);
+
+    auto store = g_stores.value(viewSize);
+    if (store && store->name == name) {
+        return store;
+    }
+
+    store = !name.isEmpty() ? openStore(name, viewSize) : MappingPtr();
+    if (store) {
+        g_stores.insert(viewSize, store);
+    } else {
+        g_stores.remove(viewSize);
+    }
+
+    return store;
+}
+
+static void releaseStore(void *info)
+{
+    delete static_cast<MappingPtr*>(info);
+}
+
+QImage ReferenceStore::load(const QString &pngPath, const int viewSize)
+{
+    const auto store = currentStore(viewSize);
+    if (!store) {
+        return QImage();
+    }
+
+    const QFileInfo fi(pngPath);
+    const auto it = store->index.constFind(fi.absoluteFilePath());
+    if (it == store->index.constEnd() || it->size != fi.size() || it->mtime != mtime(fi)) {
+        return QImage();
+    }
+
+    // The image keeps the mapping alive, even after the store is rebuilt.
+    return QImage((const uchar*)store->data + it->offset, it->width, it->height, it->width * 4,
+                  QImage::Format_ARGB32, releaseStore, new MappingPtr(store));
+}
+
+QImage ReferenceStore::decode(const QString &pngPath, const int viewSize, JobStats *stats)
+{
+    StageTimer stages(stats);
+
+    QImage img(pngPath);
+    if (img.isNull()) {
+        throw QString("Invalid image: %1").arg(pngPath);
+    }
+    stages.lap("decode");
+
+    const QSize targetSize(viewSize, viewSize);
+    if (img.size() != targetSize) {
+        img = img.scaled(targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        stages.lap("scale");
+    }
+
+    img = img.convertToFormat(QImage::Format_ARGB32);
+    stages.lap("convert");
+
+    return img;
+}
+
+// References are the PNGs next to the tests, other images are resources used by the tests.
+static bool isReference(const QFileInfo &fi)
+{
+    const auto base = fi.absolutePath() + "/" + fi.completeBaseName();
+    return QFile::exists(base + ".svg") || QFile::exists(base + ".svgz");
+}
+
+int ReferenceStore::build(const QString &testsPath, const int viewSize)
+{
+    const auto prev = currentStore(viewSize);
+
+    QMap<QString, Source> sources; // Sorted, so neighbouring tests are close in the store.
+    QDirIterator dirIt(testsPath, { "*.png" }, QDir::Files, QDirIterator::Subdirectories);
+    while (dirIt.hasNext()) {
+        dirIt.next();
+        const auto fi = dirIt.fileInfo();
+        if (isReference(fi)) {
+            sources.insert(fi.absoluteFilePath(), { fi.size(), mtime(fi), false });
+        }
+    }
+
+    // The store is shared by all test suites.
+    const auto root = QDir(testsPath).absolutePath() + "/";
+    if (prev) {
+        for (auto it = prev->index.constBegin(); it != prev->index.constEnd(); ++it) {
+            const QFileInfo fi(it.key());
+            if (!it.key().startsWith(root) && fi.exists()) {
+                sources.insert(it.key(), { fi.size(), mtime(fi), false });
+            }
+        }
+    }
+
+    QStringList changed;
+    for (auto it = sources.begin(); it != sources.end(); ++it) {
+        if (prev && prev->index.contains(it.key())) {
+            const auto entry = prev->index.value(it.key());
+            it->isReused = entry.size == it->size && entry.mtime == it->mtime;
+        }
+
+        if (!it->isReused) {
+            changed << it.key();
+        }
+    }
+
+    if (prev && changed.isEmpty() && prev->index.size() == sources.size()) {
+        return 0;
+    }
+
+    QDir().mkpath(storeDir());
+
+    // Readers that have mapped the previous blob, including this process, keep using it.
+    auto stamp = QDateTime::currentMSecsSinceEpoch();
+    QString name;
+    do {
+        name = QString("%1-%2.blob").arg(viewSize).arg(stamp++);
+    } while (QFile::exists(storeDir() + "/" + name));
+
+    const auto path = storeDir() + "/" + name;
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        throw QString("Failed to open %1.").arg(path);
+    }
+
+    QHash<QString, Entry> index;
+    qint64 offset = Alignment;
+    const QByteArray padding(Alignment, '\0');
+
+    const auto write = [&](const char *data, const qint64 size) {
+        if (file.write(data, size) != size) {
+            throw QString("Failed to write %1.").arg(path);
+        }
+    };
+
+    const auto append = [&](const QString &key, const uchar *pixels, const int w, const int h) {
+        const auto &source = sources[key];
+        const Entry entry { source.size, source.mtime, w, h, quint64(offset) };
+        const qint64 size = pixelsSize(entry);
+        write((const char*)pixels, size);
+        write(padding.constData(), aligned(size) - size);
+        offset += aligned(size);
+        index.insert(key, entry);
+    };
+
+    write(padding.constData(), Alignment); // The header is written last.
+
+    for (auto it = sources.constBegin(); it != sources.constEnd(); ++it) {
+        if (it->isReused) {
+            const auto entry = prev->index.value(it.key());
+            append(it.key(), prev->data + entry.offset, entry.width, entry.height);
+        }
+    }
+
+    // Decoded in chunks, since all references of a large view size may not fit in memory.
+    int decoded = 0;
+    const int chunkSize = QThread::idealThreadCount() * 4;
+    for (int i = 0; i < changed.size(); i += chunkSize) {
+        const auto chunk = changed.mid(i, chunkSize);
+        const auto images = QtConcurrent::blockingMapped<QVector<QImage>>(
+            chunk, DecodeReference { viewSize });
+
+        for (int k = 0; k < chunk.size(); ++k) {
+            const auto &img = images.at(k);
+            if (!img.isNull()) {
+                append(chunk.at(k), img.constBits(), img.width(), img.height());
+                decoded++;
+            }
+        }
+    }
+
+    QByteArray indexData;
+    {
+        QDataStream stream(&indexData, QIODevice::WriteOnly);
+        stream << index;
+    }
+    write(indexData.constData(), indexData.size());
+
+    QByteArray header;
+    {
+        QDataStream stream(&header, QIODevice::WriteOnly);
+        stream << StoreMagic << StoreVersion << quint32(viewSize)
+               << quint64(offset) << quint64(indexData.size());
+    }
+
+    if (!file.seek(0)) {
+        throw QString("Failed to write %1.").arg(path);
+    }
+    write(header.constData(), header.size());
+
+    if (!file.commit()) {
+        throw QString("Failed to write %1.").arg(path);
+    }
+
+    QSaveFile pointer(pointerPath(viewSize));
+    if (!pointer.open(QFile::WriteOnly) || pointer.write(name.toUtf8()) < 0 || !pointer.commit()) {
+        QFile::remove(path);
+        throw QString("Failed to write %1.").arg(pointerPath(viewSize));
+    }
+
+    removeOldBlobs(viewSize, name);
+
+    // From before the blobs were versioned.
+    QFile::remove(QString("%1/%2.blob").arg(storeDir()).arg(viewSize));
+
+    return decoded;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QImage>
+
+struct JobStats;
+
+// Reference images decoded and scaled for a view size, stored in a single
+// memory-mapped file in `Paths::workDir()`.
+//
+// Pixels are raw ARGB32, so loading a reference doesn't copy or decode anything
+// and the pages are shared by all vdiff processes. Entries are keyed by the PNG path
+// and are ignored once the PNG is changed.
+class ReferenceStore
+{
+public:
+    // Returns a read-only image backed by the store
+    // or a null image when the reference is missing or outdated.
+    static QImage load(const QString &pngPath, const int viewSize);
+
+    // Decodes, scales and converts a reference PNG, like it is stored.
+    // Throws QString on error.
+    static QImage decode(const QString &pngPath, const int viewSize, JobStats *stats = nullptr);
+
+    // Adds references from `testsPath` that are missing or outdated.
+    // Unchanged ones are copied from the previous store.
+    // Returns the number of decoded references. Throws QString on error.
+    static int build(const QString &testsPath, const int viewSize);
+};
@@ -1,174 +1,401 @@
+#include <QCoreApplication>
 #include <QFile>
 #include <QFileInfo>
 #include <QPainter>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QSemaphore>
+#include <QThreadPool>
 #include <QImageReader>
 #include <QUrl>
-#include <QXmlStreamReader>
-#include <QtConcurrent/QtConcurrentMap>
-#include <QtConcurrent/QtConcurrentRun>
 
-#include <cmath>
+#include <algorithm>
+#include <climits>
+#include <functional>
 
+#include "diffkernel.h"
+#include "imagepool.h"
 #include "paths.h"
 #include "process.h"
+#include "referencestore.h"
+#include "rendercache.h"
+#include "renderhistory.h"
+#include "renderserver.h"
+#include "testindex.h"
 
 #include "render.h"
 
-static QSize guessSvgSize(const QString &path)
+Render::Render(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<RenderResult>("RenderResult");
+    qRegisterMetaType<DiffOutput>("DiffOutput");
+
+    m_prefetched.setMaxCost(256 * 1024); // KiB
+}
+
+Render::~Render()
+{
+    cancel();
+    resetPrefetch();
+}
+
+void Render::setScale(qreal s)
 {
-    QFile file(path);
-    if (!file.open(QFile::ReadOnly)) {
-        return QSize();
+    m_dpiScale = s;
+    m_viewSize = m_settings->viewSize * s;
+
+    // Backends or the view size could have been changed.
+    resetPrefetch();
+}
+
+void Render::render(const QString &path, const bool useCache)
+{
+    cancel();
+
+    m_imgPath = path;
+    m_useCache = useCache;
+    m_imgs.clear();
+    m_errors.clear();
+    m_diffed.clear();
+    m_pendingDiffs = 0;
+    m_isRenderDone = false;
+    m_isRendering = true;
+    m_waitForPrefetch = false;
+
+    if (!useCache) {
+        m_prefetched.remove(path);
+    } else if (m_prefetched.contains(path)) {
+        // Shown results are not kept, so their stats are reported only once.
+        const QScopedPointer<QVector<RenderResult>> results(m_prefetched.take(path));
+        setImages(*results);
+        return;
+    } else if (m_prefetchJobs.contains(path)) {
+        // Will be finished by `onPrefetched`.
+        m_waitForPrefetch = true;
+        return;
     }
 
-    QXmlStreamReader reader(&file);
-    if (!reader.readNextStartElement()) {
-        return QSize();
+    renderImages();
+}
+
+void Render::cancel()
+{
+    m_renderId++;
+    m_renderFuture.cancel();
+    for (auto &future : m_diffFutures) {
+        future.cancel();
     }
+    m_diffFutures.clear();
 
-    if (reader.name() != QLatin1String("svg")) {
-        return QSize();
+    if (m_cancel) {
+        m_cancel->testAndSetRelease(0, 1);
+        m_cancel.reset();
     }
+}
 
-    const auto attributes = reader.attributes();
-    const auto viewBoxStr = attributes.value("viewBox");
-    const auto widthStr = attributes.value("width");
-    const auto heightStr = attributes.value("height");
+void Render::prefetch(const QStringList &paths)
+{
+    for (auto it = m_prefetchJobs.begin(); it != m_prefetchJobs.end(); ++it) {
+        if (!paths.contains(it.key()) && it.key() != m_imgPath) {
+            it.value().future.cancel();
+        }
+    }
+
+    m_prefetchQueue = paths;
+    startPrefetch();
+}
 
-    const auto vbValues = viewBoxStr.split(' ');
-    if (vbValues.size() != 4) {
-        return QSize();
+void Render::startPrefetch()
+{
+    if (m_isRendering) {
+        return;
     }
 
-    auto width = widthStr.isEmpty() ? vbValues[2].toDouble() : widthStr.toDouble();
-    auto height = heightStr.isEmpty() ? vbValues[3].toDouble() : heightStr.toDouble();
+    for (const auto &path : m_prefetchQueue) {
+        if (m_prefetched.contains(path) || m_prefetchJobs.contains(path)) {
+            continue;
+        }
 
-    return QSize(width, height);
+        // Low priority tasks only get the workers the current test doesn't need.
+        const auto future = Scheduler::instance().mapped(prepareJobs(*m_settings, path, m_viewSize),
+                                                         &Render::renderImage, &Render::renderCost,
+                                                         Scheduler::Priority::Low);
+
+        const int id = ++m_prefetchId;
+        m_prefetchJobs.insert(path, { id, future });
+
+        auto watcher = new QFutureWatcher<RenderResult>(this);
+        connect(watcher, &QFutureWatcher<RenderResult>::finished, this, [this, watcher, path, id]() {
+            watcher->deleteLater();
+            onPrefetched(path, id, watcher->future());
+        });
+        watcher->setFuture(future);
+    }
 }
 
-Render::Render(QObject *parent)
-    : QObject(parent)
+void Render::resetPrefetch()
 {
-    qRegisterMetaType<RenderResult>("RenderResult");
-    qRegisterMetaType<DiffOutput>("DiffOutput");
-
-    connect(&m_watcher1, &QFutureWatcher<RenderResult>::resultReadyAt,
-            this, &Render::onImageRendered);
-    connect(&m_watcher1, &QFutureWatcher<RenderResult>::finished,
-            this, &Render::onImagesRendered);
+    for (auto &job : m_prefetchJobs) {
+        job.future.cancel();
+    }
 
-    connect(&m_watcher2, &QFutureWatcher<DiffOutput>::resultReadyAt,
-            this, &Render::onDiffResult);
-    connect(&m_watcher2, &QFutureWatcher<DiffOutput>::finished,
-            this, &Render::onDiffFinished);
+    // Results of the tasks that are still running will be ignored by `onPrefetched`.
+    m_prefetchJobs.clear();
+    m_prefetchQueue.clear();
+    m_prefetched.clear();
+    m_waitForPrefetch = false;
 }
 
-void Render::setScale(qreal s)
+void Render::onPrefetched(const QString &path, const int id, const QFuture<RenderResult> &future)
 {
-    m_dpiScale = s;
-    m_viewSize = m_settings->viewSize * s;
+    if (!m_prefetchJobs.contains(path) || m_prefetchJobs.value(path).id != id) {
+        return;
+    }
+
+    m_prefetchJobs.remove(path);
+
+    QVector<RenderResult> results;
+    if (!future.isCanceled()) {
+        results = future.results().toVector();
+    }
+
+    const bool isWaiting = m_waitForPrefetch && path == m_imgPath;
+    if (isWaiting) {
+        m_waitForPrefetch = false;
+        if (results.isEmpty()) {
+            renderImages();
+        } else {
+            setImages(results);
+        }
+    }
+
+    if (!isWaiting && !results.isEmpty()) {
+        int cost = 0;
+        for (const auto &res : results) {
+            cost += res.img.sizeInBytes() / 1024;
+        }
+
+        m_prefetched.insert(path, new QVector<RenderResult>(results), cost);
+    }
+
+    startPrefetch();
 }
 
-void Render::render(const QString &path)
+void Render::setImages(const QVector<RenderResult> &results)
 {
-    m_imgPath = path;
-    m_imgs.clear();
-    renderImages();
+    for (const auto &res : results) {
+        onImageRendered(res);
+    }
+
+    onImagesRendered();
 }
 
-QImage Render::renderReference(const RenderData &data)
+QImage Render::renderReference(const RenderData &data, JobStats *stats)
 {
+    StageTimer stages(stats);
+
     const QFileInfo fi(data.imgPath);
     const QString path = fi.absolutePath() + "/" + fi.completeBaseName() + ".png";
 
     Q_ASSERT(QFile(path).exists());
 
-    const QSize targetSize(data.viewSize, data.viewSize);
+    const auto img = ReferenceStore::load(path, data.viewSize);
+    stages.lap("lookup");
+    if (!img.isNull()) {
+        return img;
+    }
+
+    return ReferenceStore::decode(path, data.viewSize, stats);
+}
+
+// A JVM runs GC and JIT threads next to the renderer,
+// so its CPU time can be larger than the wall time.
+static const int CpuTimeFactor = 4;
 
-    QImage img(path);
-    if (img.size() != targetSize) {
-        img = img.scaled(targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+// The converter run time in ms, from the last `render` (server) or `process` stage
+// after `firstStage`. The connect stage, which includes a server startup, is not counted.
+static qint64 converterTime(const JobStats &stats, const int firstStage)
+{
+    for (int i = stats.stages.size() - 1; i >= firstStage; --i) {
+        const auto &stage = stats.stages.at(i);
+        if (stage.name == QLatin1String("render") || stage.name == QLatin1String("process")) {
+            return stage.wallTime / 1000;
+        }
     }
 
-    return img.convertToFormat(QImage::Format_ARGB32);
+    return 0;
 }
 
-QImage Render::renderViaLibrary(const RenderData &data)
+QImage Render::renderViaLibrary(const RenderData &data, JobStats *stats)
 {
+    StageTimer stages(stats);
+
+    QString cacheKey;
+    if (data.useCache) {
+        cacheKey = RenderCache::key(data);
+        if (!cacheKey.isEmpty()) {
+            const auto img = RenderCache::load(data.type, cacheKey);
+            stages.lap("lookup");
+            if (!img.isNull()) {
+                return img;
+            }
+        }
+    }
+
+    // The same backend can be rendered by several threads or vdiff instances at once,
+    // so each job needs its own output file.
+    static QAtomicInt jobId;
     auto outImg = Paths::workDir();
     switch (data.type) {
-            case Backend::Batik   : outImg += "/batik.png"; break;
-            case Backend::EchoSVG       : outImg += "/echosvg.png"; break;
-            case Backend::JSVG        : outImg += "/jsvg.png"; break;
-            case Backend::SVGSalamander  : outImg += "/svgsalamander.png"; break;
+            case Backend::Batik   : outImg += "/batik"; break;
+            case Backend::EchoSVG       : outImg += "/echosvg"; break;
+            case Backend::JSVG        : outImg += "/jsvg"; break;
+            case Backend::SVGSalamander  : outImg += "/svgsalamander"; break;
+            default : break;
         }
+    outImg += QString("-%1-%2.png").arg(QCoreApplication::applicationPid())
+                                    .arg(jobId.fetchAndAddRelaxed(1));
     
-    // Construct the EchoSVG command
     QStringList arguments;
-    arguments << "-Djava.awt.headless=true"
-              << "-jar"
-              << data.convPath
+    arguments << QString::number(data.viewSize)
               << QString::number(data.viewSize)
-	          << QString::number(data.viewSize)
               << data.imgPath
               << outImg;
 
-    const QString out = Process::run("java", arguments, true);
+    ProcessLimits limits;
+    limits.timeout = RenderHistory::timeout(data.type, data.imgPath, data.viewSize,
+                                            data.timeout);
+    limits.cpuTime = limits.timeout / 1000 * CpuTimeFactor;
+    limits.memory = qint64(data.memoryLimit) * 1024 * 1024;
+    limits.cancel = data.cancel.data();
 
-    auto image = loadImage(outImg);
+    if (limits.cancel && limits.cancel->loadAcquire() != 0) {
+        throw QString("Canceled.");
+    }
+
+    // The run time is recorded even when the caller doesn't need the stats.
+    JobStats runStats;
+    JobStats *convStats = stats ? stats : &runStats;
+    const int firstStage = convStats->stages.size();
+
+    // Stages of the converter itself are recorded by RenderServer and Process.
+    // The memory of a shared server can't be limited per job.
+    QImage image;
+    if (data.useServer) {
+        image = RenderServer::run(data.convPath, arguments, limits.timeout, convStats,
+                                  limits.cancel);
+        stages.restart();
+    } else {
+        arguments.prepend(data.convPath);
+        arguments.prepend("-jar");
+        arguments.prepend("-Djava.awt.headless=true");
+        Process::run("java", arguments, true, 0, convStats, limits);
+        stages.restart();
+
+        image = loadImage(outImg);
+        stages.lap("decode");
+    }
+
+    RenderHistory::record(data.type, data.imgPath, data.viewSize,
+                          converterTime(*convStats, firstStage));
 
     // Crop image. EchoSVG always produces a rectangular image.
     if (!data.imageSize.isEmpty() && data.imageSize != image.size()) {
         const auto y = (image.height() - data.imageSize.height()) / 2;
-        image = image.copy(0, y, data.imageSize.width(), data.imageSize.height());
+        image = ImagePool::crop(image, QRect(0, y, data.imageSize.width(),
+                                             data.imageSize.height()));
+        stages.lap("crop");
+    }
+
+    if (!cacheKey.isEmpty()) {
+        RenderCache::store(data.type, cacheKey, image);
+        stages.lap("store");
     }
 
     return image;
 }
 
-void Render::renderImages()
+QVector<RenderData> Render::prepareJobs(const Settings &settings, const QString &path,
+                                        const int viewSize)
 {
-    const auto ts = m_settings->testSuite;
+    const auto ts = settings.testSuite;
 
     QVector<RenderData> list;
 
     // Parsing SVG using QtSvg directly is a bad idea, because it can crash.
-    auto imageSize = guessSvgSize(m_imgPath);
+    auto imageSize = TestIndex::get(path).size;
     if (imageSize.isEmpty()) {
-        imageSize = QSize(m_viewSize, m_viewSize);
+        imageSize = QSize(viewSize, viewSize);
     }
-    imageSize = imageSize * (float(m_viewSize) / imageSize.width());
+    imageSize = imageSize * (float(viewSize) / imageSize.width());
 
-    list.append({ Backend::Reference, m_viewSize, imageSize, m_imgPath, QString(), ts });
+    const bool useServer = settings.useRenderServer;
+    const bool useCache = settings.useRenderCache;
+    const int timeout = settings.jobTimeout * 1000;
+    const int memoryLimit = settings.jobMemoryLimit;
+
+    list.append({ Backend::Reference, viewSize, imageSize, path, QString(), ts, false, false,
+                  timeout, memoryLimit });
     
 
     auto renderCached = [&](const Backend backend, const QString &renderPath) {
-        list.append({ backend, m_viewSize, imageSize, m_imgPath, renderPath, ts });
+        list.append({ backend, viewSize, imageSize, path, renderPath, ts, useServer, useCache,
+                      timeout, memoryLimit });
     };
 
-    if (m_settings->useBatik) {
-        renderCached(Backend::Batik, m_settings->batikPath);
+    if (settings.useBatik) {
+        renderCached(Backend::Batik, settings.batikPath);
     }
 
-    if (m_settings->useJSVG) {
-        renderCached(Backend::JSVG, m_settings->jsvgPath);
+    if (settings.useJSVG) {
+        renderCached(Backend::JSVG, settings.jsvgPath);
     }
 
-    if (m_settings->useSVGSalamander) {
-        renderCached(Backend::SVGSalamander, m_settings->svgsalamanderPath);
+    if (settings.useSVGSalamander) {
+        renderCached(Backend::SVGSalamander, settings.svgsalamanderPath);
     }
 
-    if (m_settings->useEchoSVG) {
-        renderCached(Backend::EchoSVG, m_settings->echosvgPath);
+    if (settings.useEchoSVG) {
+        renderCached(Backend::EchoSVG, settings.echosvgPath);
     }
 
-    const auto future = QtConcurrent::mapped(list, &Render::renderImage);
-    m_watcher1.setFuture(future);
+    return list;
+}
+
+void Render::renderImages()
+{
+    auto list = prepareJobs(*m_settings, m_imgPath, m_viewSize);
+    m_cancel = QSharedPointer<QAtomicInt>::create(0);
+    for (auto &data : list) {
+        data.useCache = data.useCache && m_useCache;
+        data.cancel = m_cancel;
+    }
+
+    m_renderFuture = Scheduler::instance().mapped(list, &Render::renderImage, &Render::renderCost,
+                                                  Scheduler::Priority::High);
+
+    // A watcher per render, so the signals of a canceled one can be told apart.
+    const int id = m_renderId;
+    auto watcher = new QFutureWatcher<RenderResult>(this);
+    connect(watcher, &QFutureWatcher<RenderResult>::resultReadyAt, this,
+            [this, watcher, id](const int idx) {
+        if (id == m_renderId) {
+            onImageRendered(watcher->resultAt(idx));
+        }
+    });
+    connect(watcher, &QFutureWatcher<RenderResult>::finished, this, [this, watcher, id]() {
+        watcher->deleteLater();
+        if (id == m_renderId) {
+            onImagesRendered();
+        }
+    });
+    watcher->setFuture(m_renderFuture);
 }
 
 QImage Render::loadImage(const QString &path)
 {
-    const QImage img(path);
+    const QImage img = ImagePool::decode(path);
     if (img.isNull()) {
         throw QString("Invalid image: %1").arg(path);
     }
@@ -179,14 +406,15 @@ QImage Render::loadImage(const QString &path)
 
 RenderResult Render::renderImage(const RenderData &data)
 {
+    JobStats stats;
     try {
         QImage img;
         switch (data.type) {
-            case Backend::Reference   : img = renderReference(data); break;
-            default: img = renderViaLibrary(data); break;
+            case Backend::Reference   : img = renderReference(data, &stats); break;
+            default: img = renderViaLibrary(data, &stats); break;
         }
 
-        return { data.type, img };
+        return { data.type, img, QString(), stats };
     } catch (const QString &s) {
         QImage img(data.viewSize, data.viewSize, QImage::Format_ARGB32);
         img.fill(Qt::white);
@@ -200,29 +428,197 @@ RenderResult Render::renderImage(const RenderData &data)
                    s);
         p.end();
 
-        return { data.type, img };
+        return { data.type, img, s, stats };
     } catch (...) {
         Q_UNREACHABLE();
     }
 }
 
-static QImage toRGBFormat(const QImage &img, const QColor &bg)
+// The decoded and the cropped image.
+Scheduler::Cost Render::renderCost(const RenderData &data)
+{
+    const qint64 imgSize = qint64(data.viewSize) * data.viewSize * 4;
+    return { Scheduler::renderLane(data.type), imgSize * 2 };
+}
+
+// The diff image. Inputs are blended a few rows at a time.
+Scheduler::Cost Render::diffCost(const DiffData &data)
+{
+    return { Scheduler::DiffLane, data.img1.sizeInBytes() };
+}
+
+// Formats that can be blended directly. Others, which converters don't produce,
+// are converted once.
+static QImage toBlendFormat(const QImage &img)
+{
+    switch (img.format()) {
+        case QImage::Format_RGB32 :
+        case QImage::Format_ARGB32 :
+        case QImage::Format_ARGB32_Premultiplied : return img;
+        default : return img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+}
+
+// Matches the former `int(sqrt(distance2)) > 5` check.
+static const int MaxDistance2 = 35;
+
+// SSIM is computed over 8x8 blocks, so bands are aligned to them.
+static const int BlockSize = 8;
+
+// Small enough to split a 2000 px image between all cores,
+// large enough to keep a 300 px one on a single thread.
+static const int BandPixels = 64 * 1024;
+
+namespace {
+
+struct BandStats
+{
+    int mismatches = 0;
+    int minX = INT_MAX;
+    int maxX = -1;
+    int minY = -1;
+    int maxY = -1;
+    double ssimSum = 0;
+    int blocks = 0;
+    int maxDelta = 0;
+};
+
+// Runs bands pulled from a shared counter. Used by the band pool and the calling thread.
+class BandRunner : public QRunnable
+{
+public:
+    BandRunner(QAtomicInt *next, const int count, const std::function<void(int)> *fn,
+               QSemaphore *done)
+        : m_next(next), m_count(count), m_fn(fn), m_done(done)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        runBands(m_next, m_count, *m_fn);
+        m_done->release();
+    }
+
+    static void runBands(QAtomicInt *next, const int count, const std::function<void(int)> &fn)
+    {
+        int idx;
+        while ((idx = next->fetchAndAddRelaxed(1)) < count) {
+            fn(idx);
+        }
+    }
+
+private:
+    QAtomicInt * const m_next;
+    const int m_count;
+    const std::function<void(int)> * const m_fn;
+    QSemaphore * const m_done;
+};
+
+}
+
+// Bands of all diffs share the cores, independently from the scheduler,
+// whose workers are the ones waiting here.
+static QThreadPool& bandPool()
 {
-    QImage newImg(img.size(), QImage::Format_RGB32);
-    newImg.fill(bg);
+    static QThreadPool pool;
+    return pool;
+}
 
-    QPainter p(&newImg);
-    p.drawImage(0, 0, img);
-    p.end();
-    return newImg;
+// Diffs in `runParallel`.
+static QAtomicInt g_activeDiffs;
+
+// Runs `fn` for each band in parallel.
+// The calling thread processes bands too and takes back the helpers that haven't started yet,
+// so a busy pool only makes it slower, but never blocks it.
+//
+// The cores are split between the running diffs, so together with the scheduler's diff lane
+// workers, which are the calling threads, they use about as many threads as there are cores.
+static void runParallel(const int count, const std::function<void(int)> &fn)
+{
+    auto &pool = bandPool();
+    const int active = g_activeDiffs.fetchAndAddOrdered(1) + 1;
+    const int helpers = qMax(0, qMin(count, pool.maxThreadCount() / active) - 1);
+
+    QAtomicInt next;
+    QSemaphore done;
+    QVector<BandRunner*> runners;
+    for (int i = 0; i < helpers; ++i) {
+        runners << new BandRunner(&next, count, &fn, &done);
+        pool.start(runners.last());
+    }
+
+    BandRunner::runBands(&next, count, fn);
+
+    int started = 0;
+    for (auto *runner : runners) {
+        if (!pool.tryTake(runner)) {
+            started++;
+        }
+    }
+
+    done.acquire(started);
+    qDeleteAll(runners);
+
+    g_activeDiffs.deref();
 }
 
-static int colorDistance(const QColor &color1, const QColor &color2)
+// Mean SSIM of the luma over 8x8 blocks and the largest channel difference.
+// Blocks are not overlapping, which is enough to tell a shifted edge from a missing shape
+// at a fraction of the cost of a sliding gaussian window.
+static void compareStructure(const uchar *bits1, const uchar *bits2, const int bytesPerLine,
+                             const int w, const int y0, const int y1, BandStats *stats)
 {
-    const int rd = std::pow(color1.red() - color2.red(), 2);
-    const int gd = std::pow(color1.green() - color2.green(), 2);
-    const int bd = std::pow(color1.blue() - color2.blue(), 2);
-    return std::sqrt(rd + gd + bd);
+    // (0.01 * 255)^2 and (0.03 * 255)^2
+    const double C1 = 6.5025;
+    const double C2 = 58.5225;
+
+    const auto luma = [](const QRgb c) {
+        return 0.299 * qRed(c) + 0.587 * qGreen(c) + 0.114 * qBlue(c);
+    };
+
+    for (int by = y0; by < y1; by += BlockSize) {
+        const int bh = qMin(BlockSize, y1 - by);
+        for (int bx = 0; bx < w; bx += BlockSize) {
+            const int bw = qMin(BlockSize, w - bx);
+
+            double sum1 = 0, sum2 = 0, sum11 = 0, sum22 = 0, sum12 = 0;
+            for (int y = by; y < by + bh; ++y) {
+                const QRgb *row1 = (const QRgb*)(bits1 + qint64(y) * bytesPerLine);
+                const QRgb *row2 = (const QRgb*)(bits2 + qint64(y) * bytesPerLine);
+                for (int x = bx; x < bx + bw; ++x) {
+                    const QRgb c1 = row1[x];
+                    const QRgb c2 = row2[x];
+                    if (c1 != c2) {
+                        int delta = stats->maxDelta;
+                        delta = qMax(delta, qAbs(qRed(c1) - qRed(c2)));
+                        delta = qMax(delta, qAbs(qGreen(c1) - qGreen(c2)));
+                        delta = qMax(delta, qAbs(qBlue(c1) - qBlue(c2)));
+                        stats->maxDelta = delta;
+                    }
+
+                    const double l1 = luma(c1);
+                    const double l2 = luma(c2);
+                    sum1 += l1;
+                    sum2 += l2;
+                    sum11 += l1 * l1;
+                    sum22 += l2 * l2;
+                    sum12 += l1 * l2;
+                }
+            }
+
+            const double n = bw * bh;
+            const double mean1 = sum1 / n;
+            const double mean2 = sum2 / n;
+            const double var1 = sum11 / n - mean1 * mean1;
+            const double var2 = sum22 / n - mean2 * mean2;
+            const double cov = sum12 / n - mean1 * mean2;
+
+            stats->ssimSum += ((2 * mean1 * mean2 + C1) * (2 * cov + C2))
+                            / ((mean1 * mean1 + mean2 * mean2 + C1) * (var1 + var2 + C2));
+            stats->blocks++;
+        }
+    }
 }
 
 DiffOutput Render::diffImage(const DiffData &data)
@@ -236,74 +632,221 @@ DiffOutput Render::diffImage(const DiffData &data)
         qWarning() << msg;
     }
 
-    Q_ASSERT(data.img1.format() == data.img2.format());
-
     const int w = qMin(data.img1.width(), data.img2.width());
     const int h = qMin(data.img1.height(), data.img2.height());
 
-    const auto img1 = toRGBFormat(data.img1, Qt::white);
-    const auto img2 = toRGBFormat(data.img2, Qt::white);
+    JobStats stats;
+    StageTimer stages(&stats);
+
+    const QImage src1 = toBlendFormat(data.img1);
+    const QImage src2 = toBlendFormat(data.img2);
+    const bool isPremultiplied1 = src1.format() != QImage::Format_ARGB32;
+    const bool isPremultiplied2 = src2.format() != QImage::Format_ARGB32;
+
+    // The diff image has the size of the first input. Only the common area is compared.
+    const QSize size = data.img1.size();
+    QImage diffImg = ImagePool::create(size, QImage::Format_RGB32);
+    uchar *diffBits = diffImg.bits();
+    const int bytesPerLine = diffImg.bytesPerLine();
+
+    const int bandHeight = qMax(BlockSize,
+                                BandPixels / qMax(1, size.width()) / BlockSize * BlockSize);
+    const int bandsCount = (size.height() + bandHeight - 1) / bandHeight;
+    QVector<BandStats> bands(bandsCount);
+    const QRgb red = qRgb(255, 0, 0);
+    stages.lap("prepare");
+
+    // Inputs are blended over the background one block row at a time into small buffers,
+    // which are compared and dropped while still in the cache.
+    runParallel(bandsCount, [&](const int idx) {
+        const int y0 = idx * bandHeight;
+        const int y1 = qMin(y0 + bandHeight, size.height());
+        auto &band = bands[idx];
+
+        QVector<QRgb> rows1(BlockSize * w);
+        QVector<QRgb> rows2(BlockSize * w);
+
+        for (int by = y0; by < y1; by += BlockSize) {
+            const int bh = qMin(BlockSize, y1 - by);
+            for (int y = by; y < by + bh; ++y) {
+                QRgb *out = (QRgb*)(diffBits + qint64(y) * bytesPerLine);
+
+                // Pixels outside of the common area are always a mismatch.
+                const int x0 = y < h ? w : 0;
+                std::fill(out + x0, out + size.width(), red);
+                if (y >= h) {
+                    continue;
+                }
+
+                QRgb *row1 = rows1.data() + (y - by) * w;
+                QRgb *row2 = rows2.data() + (y - by) * w;
+                DiffKernel::blendRow((const QRgb*)src1.constScanLine(y), isPremultiplied1,
+                                     data.background, row1, w);
+                DiffKernel::blendRow((const QRgb*)src2.constScanLine(y), isPremultiplied2,
+                                     data.background, row2, w);
+
+                int rowMinX = 0;
+                int rowMaxX = 0;
+                const int n = DiffKernel::compareRow(row1, row2, out, w, MaxDistance2,
+                                                     &rowMinX, &rowMaxX);
+                if (n != 0) {
+                    band.mismatches += n;
+                    band.minX = qMin(band.minX, rowMinX);
+                    band.maxX = qMax(band.maxX, rowMaxX);
+                    if (band.minY == -1) {
+                        band.minY = y;
+                    }
+                    band.maxY = y;
+                }
+            }
 
-    QImage diffImg(data.img1.size(), QImage::Format_RGB32);
-    diffImg.fill(Qt::red);
+            if (by < h) {
+                compareStructure((const uchar*)rows1.constData(), (const uchar*)rows2.constData(),
+                                 w * 4, w, 0, qMin(bh, h - by), &band);
+            }
+        }
+    });
+
+    stages.lap("diff");
+
+    // Bands are merged in order, so the result doesn't depend on the number of threads.
+    int mismatches = 0;
+    int minX = INT_MAX;
+    int maxX = -1;
+    int minY = -1;
+    int maxY = -1;
+    double ssimSum = 0;
+    int blocks = 0;
+    DiffMetrics metrics;
+    for (const auto &band : bands) {
+        if (band.mismatches != 0) {
+            mismatches += band.mismatches;
+            minX = qMin(minX, band.minX);
+            maxX = qMax(maxX, band.maxX);
+            if (minY == -1) {
+                minY = band.minY;
+            }
+            maxY = band.maxY;
+        }
 
-    for (int y = 0; y < h; ++y) {
-        auto s1 = (QRgb*)(img1.constScanLine(y));
-        auto s2 = (QRgb*)(img2.constScanLine(y));
-        auto s3 = (QRgb*)(diffImg.scanLine(y));
+        ssimSum += band.ssimSum;
+        blocks += band.blocks;
+        metrics.maxDelta = qMax(metrics.maxDelta, band.maxDelta);
+    }
 
-        for (int x = 0; x < w; ++x) {
-            QRgb c1 = *s1;
-            QRgb c2 = *s2;
+    QRect bbox;
+    if (mismatches != 0) {
+        bbox = QRect(QPoint(minX, minY), QPoint(maxX, maxY));
+    }
 
-            if (colorDistance(c1, c2) > 5) {
-                *s3 = qRgb(255, 0, 0);
-            } else {
-                *s3 = qRgb(255, 255, 255);
-            }
+    const QRect right(w, 0, diffImg.width() - w, h);
+    const QRect bottom(0, h, diffImg.width(), diffImg.height() - h);
+    for (const QRect &r : { right, bottom }) {
+        if (!r.isEmpty()) {
+            mismatches += r.width() * r.height();
+            bbox = bbox.united(r);
 
-            s1++;
-            s2++;
-            s3++;
+            // A size mismatch is never a rounding error.
+            metrics.maxDelta = 255;
         }
     }
 
-    return { data.type, diffImg };
+    metrics.ssim = blocks == 0 ? 1.0 : ssimSum / blocks;
+
+    const qint64 pixels = qint64(diffImg.width()) * diffImg.height();
+    metrics.ratio = pixels == 0 ? 0.0 : double(mismatches) / pixels;
+
+    return { data.type, diffImg, mismatches, bbox, metrics, stats };
 }
 
-void Render::onImageRendered(const int idx)
+// Diffs are started as soon as both images are ready, so the fast backends
+// don't wait for the slow ones.
+void Render::startDiff(const Backend type)
 {
-    const auto res = m_watcher1.resultAt(idx);
-    m_imgs.insert(res.type, res.img);
-    emit imageReady(res.type, res.img);
+    if (type == Backend::Reference || m_diffed.contains(type)) {
+        return;
+    }
+
+    m_diffed.insert(type);
+    m_pendingDiffs++;
+
+    const QVector<DiffData> list {
+        { type, m_imgs.value(Backend::Reference), m_imgs.value(type), m_settings->diffBackground }
+    };
+    const auto future = Scheduler::instance().mapped(list, &Render::diffImage, &Render::diffCost,
+                                                     Scheduler::Priority::High);
+    m_diffFutures.append(future);
+
+    const int id = m_renderId;
+    auto watcher = new QFutureWatcher<DiffOutput>(this);
+    connect(watcher, &QFutureWatcher<DiffOutput>::finished, this, [this, watcher, id]() {
+        watcher->deleteLater();
+        if (id != m_renderId) {
+            return;
+        }
+
+        if (watcher->future().resultCount() != 0) {
+            onDiffResult(watcher->result());
+        }
+
+        m_pendingDiffs--;
+        if (m_isRenderDone && m_pendingDiffs == 0) {
+            onDiffFinished();
+        }
+    });
+    watcher->setFuture(future);
 }
 
-void Render::onImagesRendered()
+void Render::onImageRendered(const RenderResult &res)
 {
-        const QImage refImg = m_imgs.value(Backend::Reference);
+    m_imgs.insert(res.type, res.img);
+    if (!res.error.isEmpty()) {
+        m_errors.insert(res.type);
+    }
+    emit imageReady(res.type, res.img, res.stats);
 
-        QVector<DiffData> list;
-        const auto append = [&](const Backend type){
-            if (m_imgs.contains(type) && type != Backend::Reference) {
-                list.append({ type, refImg, m_imgs.value(type) });
-            }
-        };
+    if (res.type == Backend::Reference) {
+        for (auto it = m_imgs.constBegin(); it != m_imgs.constEnd(); ++it) {
+            startDiff(it.key());
+        }
+    } else if (m_imgs.contains(Backend::Reference)) {
+        startDiff(res.type);
+    }
+}
 
-        for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
-            append((Backend)t);
+void Render::onImagesRendered()
+{
+    // Backends that are still waiting for a missing reference.
+    for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+        if (m_imgs.contains((Backend)t)) {
+            startDiff((Backend)t);
         }
+    }
 
-        const auto future = QtConcurrent::mapped(list, &Render::diffImage);
-        m_watcher2.setFuture(future);
+    m_isRenderDone = true;
+    if (m_pendingDiffs == 0) {
+        onDiffFinished();
+    }
 }
 
-void Render::onDiffResult(const int idx)
+void Render::onDiffResult(const DiffOutput &v)
 {
-    const auto v = m_watcher2.resultAt(idx);
-    emit diffReady(v.type, v.img);
+    // A converter error is a crash, whatever the error image looks like.
+    // Nothing can be said without a reference.
+    auto verdict = TestState::Unknown;
+    if (m_errors.contains(v.type)) {
+        verdict = TestState::Crashed;
+    } else if (!m_errors.contains(Backend::Reference)) {
+        verdict = Classifier::classify(m_settings->policy(), v.metrics);
+    }
+
+    emit diffReady(v, verdict);
 }
 
 void Render::onDiffFinished()
 {
+    m_isRendering = false;
     emit finished();
+
+    startPrefetch();
 }
@@ -1,9 +1,15 @@
 #pragma once
 
 #include <QObject>
+#include <QAtomicInt>
+#include <QCache>
 #include <QFutureWatcher>
 #include <QImage>
+#include <QSet>
+#include <QSharedPointer>
 
+#include "jobstats.h"
+#include "scheduler.h"
 #include "settings.h"
 
 struct RenderData
@@ -14,12 +20,19 @@ struct RenderData
     QString imgPath;
     QString convPath;
     TestSuite testSuite;
+    bool useServer;
+    bool useCache;
+    int timeout; // The longest converter run, ms.
+    int memoryLimit; // Of a converter process, MiB, 0 when unlimited.
+    QSharedPointer<QAtomicInt> cancel; // Optional. Stops the converter once set.
 };
 
 struct RenderResult
 {
     Backend type;
     QImage img;
+    QString error;
+    JobStats stats;
 };
 
 struct DiffData
@@ -27,12 +40,17 @@ struct DiffData
     Backend type;
     QImage img1;
     QImage img2;
+    QRgb background; // Transparent pixels are compared over it.
 };
 
 struct DiffOutput
 {
     Backend type;
     QImage img;
+    int mismatches;
+    QRect bbox;
+    DiffMetrics metrics;
+    JobStats stats;
 };
 
 Q_DECLARE_METATYPE(RenderResult)
@@ -44,39 +62,82 @@ class Render : public QObject
 
 public:
     explicit Render(QObject *parent = nullptr);
+    ~Render();
 
     void setScale(qreal s);
 
-    void render(const QString &path);
+    // Cancels the previous test, if it's still in progress. Its tasks that haven't started
+    // are skipped, its converters are stopped and its results are dropped.
+    void render(const QString &path, const bool useCache = true);
+
+    // Renders the specified tests in background once the current one is done.
+    // Prefetches of tests that are not in the list anymore are canceled.
+    void prefetch(const QStringList &paths);
 
     void setSettings(Settings *settings) { m_settings = settings; }
 
+    // Already multiplied by the device pixel ratio.
+    int viewSize() const { return m_viewSize; }
+
+    // Building blocks shared with the batch mode.
+    static QVector<RenderData> prepareJobs(const Settings &settings, const QString &path,
+                                           const int viewSize);
+    static RenderResult renderImage(const RenderData &data);
+    static DiffOutput diffImage(const DiffData &data);
+    static Scheduler::Cost renderCost(const RenderData &data);
+    static Scheduler::Cost diffCost(const DiffData &data);
+
 signals:
-    void imageReady(Backend, QImage);
-    void diffReady(Backend, QImage);
+    void imageReady(Backend, QImage, JobStats);
+    // `verdict` is the classification by the current policy.
+    void diffReady(DiffOutput, TestState verdict);
     void finished();
 
 private:
+    struct PrefetchJob
+    {
+        int id;
+        QFuture<RenderResult> future;
+    };
+
+    void cancel();
     void renderImages();
+    void startPrefetch();
+    void resetPrefetch();
+    void onPrefetched(const QString &path, const int id, const QFuture<RenderResult> &future);
+    void setImages(const QVector<RenderResult> &results);
 
     static QImage loadImage(const QString &path);
-    static QImage renderReference(const RenderData &data);
-    static QImage renderViaLibrary(const RenderData &data);
-    static RenderResult renderImage(const RenderData &data);
-    static DiffOutput diffImage(const DiffData &data);
+    static QImage renderReference(const RenderData &data, JobStats *stats);
+    static QImage renderViaLibrary(const RenderData &data, JobStats *stats);
+
+    void startDiff(const Backend type);
 
-private slots:
-    void onImageRendered(const int idx);
+    void onImageRendered(const RenderResult &res);
     void onImagesRendered();
-    void onDiffResult(const int idx);
+    void onDiffResult(const DiffOutput &v);
     void onDiffFinished();
 
 private:
     Settings *m_settings = nullptr;
     int m_viewSize = 300;
     qreal m_dpiScale = 1.0;
-    QFutureWatcher<RenderResult> m_watcher1;
-    QFutureWatcher<DiffOutput> m_watcher2;
+    QFuture<RenderResult> m_renderFuture;
+    QVector<QFuture<DiffOutput>> m_diffFutures;
+    QSharedPointer<QAtomicInt> m_cancel;
+    int m_renderId = 0; // Results of the previous renders are ignored.
     QString m_imgPath;
+    bool m_useCache = true;
+    bool m_isRendering = false;
+    bool m_waitForPrefetch = false;
     QHash<Backend, QImage> m_imgs;
+    QSet<Backend> m_errors;
+    QSet<Backend> m_diffed; // Backends with a started diff.
+    int m_pendingDiffs = 0;
+    bool m_isRenderDone = false;
+
+    QStringList m_prefetchQueue;
+    QHash<QString, PrefetchJob> m_prefetchJobs;
+    QCache<QString, QVector<RenderResult>> m_prefetched;
+    int m_prefetchId = 0;
 };
@@ -0,0 +1,202 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+
+#include <algorithm>
+
+#include "imagepool.h"
+#include "paths.h"
+#include "render.h"
+#include "testindex.h"
+
+#include "rendercache.h"
+
+namespace {
+
+struct ConverterStamp
+{
+    qint64 size;
+    QDateTime lastModified;
+    QByteArray hash;
+};
+
+struct CacheEntry
+{
+    QString path;
+    qint64 size;
+    QDateTime lastModified;
+};
+
+QMutex g_cacheMutex;
+qint64 g_maxSize = 512 * 1024 * 1024;
+qint64 g_totalSize = -1; // Unknown until the cache directory is scanned.
+
+QMutex g_convertersMutex;
+QHash<QString, ConverterStamp> g_converters;
+
+}
+
+static QString cacheDir()
+{
+    return Paths::workDir() + "/render-cache";
+}
+
+static QString backendDir(const Backend backend)
+{
+    return cacheDir() + "/" + backendToString(backend).toLower();
+}
+
+// Converters are large, so they are rehashed only when changed on disk.
+QByteArray RenderCache::converterHash(const QString &path)
+{
+    const QFileInfo fi(path);
+
+    QMutexLocker lock(&g_convertersMutex);
+
+    const auto it = g_converters.constFind(path);
+    if (   it != g_converters.constEnd()
+        && it->size == fi.size()
+        && it->lastModified == fi.lastModified()) {
+        return it->hash;
+    }
+
+    const ConverterStamp stamp { fi.size(), fi.lastModified(), Paths::fileHash(path) };
+    g_converters.insert(path, stamp);
+    return stamp.hash;
+}
+
+static qint64 scanCache(QVector<CacheEntry> *entries)
+{
+    qint64 total = 0;
+    QDirIterator it(cacheDir(), { "*.png" }, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const auto fi = it.fileInfo();
+        total += fi.size();
+
+        if (entries) {
+            entries->append({ fi.absoluteFilePath(), fi.size(), fi.lastModified() });
+        }
+    }
+
+    return total;
+}
+
+// Removes the least recently used renders. Must be called with `g_cacheMutex` locked.
+static void evict()
+{
+    QVector<CacheEntry> entries;
+    g_totalSize = scanCache(&entries);
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) {
+        return a.lastModified < b.lastModified;
+    });
+
+    // Leave some headroom, so we don't scan the cache after each render.
+    const qint64 target = g_maxSize / 10 * 9;
+    for (const auto &entry : entries) {
+        if (g_totalSize <= target) {
+            break;
+        }
+
+        if (QFile::remove(entry.path)) {
+            g_totalSize -= entry.size;
+        }
+    }
+}
+
+QString RenderCache::key(const RenderData &data)
+{
+    // The content hash and the resources come from the metadata index,
+    // so the SVG isn't read again.
+    const auto meta = TestIndex::get(data.imgPath);
+    if (meta.hash.isEmpty()) {
+        return QString();
+    }
+
+    const auto convHash = converterHash(data.convPath);
+    if (convHash.isEmpty()) {
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(meta.hash);
+
+    for (const auto &path : meta.resources) {
+        hash.addData(path.toUtf8());
+        hash.addData(Paths::fileHash(path));
+    }
+
+    hash.addData(convHash);
+
+    // `viewSize` is already multiplied by the device pixel ratio.
+    hash.addData(QString("%1:%2:%3x%4")
+                 .arg(backendToString(data.type)).arg(data.viewSize)
+                 .arg(data.imageSize.width()).arg(data.imageSize.height()).toUtf8());
+
+    return hash.result().toHex();
+}
+
+QImage RenderCache::load(const Backend backend, const QString &key)
+{
+    QFile file(backendDir(backend) + "/" + key + ".png");
+    if (!file.open(QFile::ReadOnly)) {
+        return QImage();
+    }
+
+    const auto img = ImagePool::decode(&file, "PNG");
+
+    // Used for eviction.
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    return img;
+}
+
+void RenderCache::store(const Backend backend, const QString &key, const QImage &img)
+{
+    const auto dir = backendDir(backend);
+    QDir().mkpath(dir);
+
+    // Write atomically, since several vdiff instances can share the cache.
+    const auto path = dir + "/" + key + ".png";
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly) || !img.save(&file, "PNG") || !file.commit()) {
+        qWarning() << "Failed to cache" << path;
+        return;
+    }
+
+    QMutexLocker lock(&g_cacheMutex);
+
+    if (g_totalSize < 0) {
+        g_totalSize = scanCache(nullptr);
+    } else {
+        g_totalSize += QFileInfo(path).size();
+    }
+
+    if (g_totalSize > g_maxSize) {
+        evict();
+    }
+}
+
+void RenderCache::invalidate(const Backend backend)
+{
+    QMutexLocker lock(&g_cacheMutex);
+
+    QDir(backendDir(backend)).removeRecursively();
+    g_totalSize = -1;
+}
+
+void RenderCache::setMaxSize(const qint64 bytes)
+{
+    QMutexLocker lock(&g_cacheMutex);
+
+    g_maxSize = bytes;
+    if (g_totalSize > g_maxSize) {
+        evict();
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QImage>
+
+#include "tests.h"
+
+struct RenderData;
+
+// Persistent cache of backend renders stored in `Paths::workDir()`.
+//
+// Renders are keyed by the SVG content, the files it references,
+// the converter binary, the backend and the image size,
+// so any change to them results in a new render.
+class RenderCache
+{
+public:
+    // Returns an empty string when the key cannot be computed.
+    static QString key(const RenderData &data);
+
+    // SHA-1 of a converter, rehashed only when it was changed on disk.
+    static QByteArray converterHash(const QString &path);
+
+    static QImage load(const Backend backend, const QString &key);
+    static void store(const Backend backend, const QString &key, const QImage &img);
+
+    static void invalidate(const Backend backend);
+
+    static void setMaxSize(const qint64 bytes);
+};
@@ -0,0 +1,132 @@
+#include <QDataStream>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+
+#include "paths.h"
+
+#include "renderhistory.h"
+
+namespace {
+
+// Backend, view size and absolute path -> run time in ms.
+// A larger image can take much longer to render.
+typedef QHash<QString, qint64> History;
+
+QMutex g_mutex;
+History g_history;
+bool g_isLoaded = false;
+bool g_isChanged = false;
+QElapsedTimer g_lastSave;
+
+}
+
+static const quint32 HistoryMagic = 0x76646874; // vdht
+static const quint32 HistoryVersion = 2;
+
+// A JVM startup alone can take seconds when all cores are busy.
+static const int MinTimeout = 15000; // ms
+static const int TimeoutFactor = 5;
+
+static const int SaveInterval = 10000; // ms
+
+static QString historyPath()
+{
+    return Paths::workDir() + "/render-history.index";
+}
+
+static QString historyKey(const Backend backend, const QString &path, const int viewSize)
+{
+    return QString("%1\t%2\t%3").arg(backendToString(backend)).arg(viewSize).arg(path);
+}
+
+static History loadHistory()
+{
+    QFile file(historyPath());
+    if (!file.open(QFile::ReadOnly)) {
+        return History();
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (magic != HistoryMagic || version != HistoryVersion) {
+        return History();
+    }
+
+    History history;
+    stream >> history;
+    if (stream.status() != QDataStream::Ok) {
+        return History();
+    }
+
+    return history;
+}
+
+// Must be called with `g_mutex` locked.
+static void ensureLoaded()
+{
+    if (!g_isLoaded) {
+        g_history = loadHistory();
+        g_isLoaded = true;
+        g_lastSave.start();
+    }
+}
+
+// Must be called with `g_mutex` locked.
+static void saveHistory()
+{
+    g_isChanged = false;
+    g_lastSave.restart();
+
+    QSaveFile file(historyPath());
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Failed to write" << historyPath();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << HistoryMagic << HistoryVersion << g_history;
+    file.commit();
+}
+
+int RenderHistory::timeout(const Backend backend, const QString &path, const int viewSize,
+                           const int maxTimeout)
+{
+    QMutexLocker lock(&g_mutex);
+    ensureLoaded();
+
+    const auto it = g_history.constFind(historyKey(backend, path, viewSize));
+    if (it == g_history.constEnd()) {
+        return maxTimeout;
+    }
+
+    return int(qMin(*it * TimeoutFactor + MinTimeout, qint64(maxTimeout)));
+}
+
+void RenderHistory::record(const Backend backend, const QString &path, const int viewSize,
+                           const qint64 ms)
+{
+    QMutexLocker lock(&g_mutex);
+    ensureLoaded();
+
+    g_history.insert(historyKey(backend, path, viewSize), ms);
+    g_isChanged = true;
+
+    if (g_lastSave.elapsed() > SaveInterval) {
+        saveHistory();
+    }
+}
+
+void RenderHistory::save()
+{
+    QMutexLocker lock(&g_mutex);
+
+    if (g_isChanged) {
+        saveHistory();
+    }
+}
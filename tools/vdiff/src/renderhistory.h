@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QString>
+
+#include "tests.h"
+
+// Converter run times of previous renders, kept in `Paths::workDir()`.
+//
+// Used to time out a job after several times its usual run time,
+// instead of blocking a worker for the longest allowed time.
+class RenderHistory
+{
+public:
+    // Returns a timeout for the next render of the test at `viewSize`, in ms,
+    // up to `maxTimeout`. A test without history gets `maxTimeout`.
+    static int timeout(const Backend backend, const QString &path, const int viewSize,
+                       const int maxTimeout);
+
+    // Records a successful converter run, without a render server startup.
+    // Saved periodically and on `save`.
+    static void record(const Backend backend, const QString &path, const int viewSize,
+                       const qint64 ms);
+
+    static void save();
+};
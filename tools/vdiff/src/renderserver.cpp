@@ -0,0 +1,347 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QProcess>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QTcpSocket>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#endif
+
+#include "imagepool.h"
+#include "jobstats.h"
+#include "paths.h"
+#include "rendercache.h"
+
+#include "renderserver.h"
+
+namespace {
+
+struct Server
+{
+    QMutex mutex;
+    qint64 pid = 0;
+    quint16 port = 0;
+    QByteArray converter; // The hash of the converter it was started with.
+
+    // Jobs share it for reading, while a retried job runs alone.
+    QReadWriteLock jobsLock;
+};
+
+// The server went down in the middle of a job.
+struct ServerLost
+{
+};
+
+const int StartupTimeout = 60000; // 1min, includes compiling RenderServer.java
+const int CancelCheckInterval = 100; // ms
+
+QMutex g_serversMutex;
+QHash<QString, QSharedPointer<Server>> g_servers;
+
+}
+
+static bool isProcessAlive(qint64 pid)
+{
+#ifdef Q_OS_UNIX
+    return ::kill(pid_t(pid), 0) == 0;
+#else
+    Q_UNUSED(pid)
+    return true; // A dead server will be detected by a failed connection.
+#endif
+}
+
+static void killProcess(qint64 pid)
+{
+#ifdef Q_OS_UNIX
+    ::kill(pid_t(pid), SIGKILL);
+#else
+    QProcess::execute("taskkill", { "/F", "/PID", QString::number(pid) });
+#endif
+}
+
+static QSharedPointer<Server> serverFor(const QString &convPath)
+{
+    QMutexLocker lock(&g_serversMutex);
+
+    auto server = g_servers.value(convPath);
+    if (!server) {
+        server = QSharedPointer<Server>::create();
+        g_servers.insert(convPath, server);
+    }
+
+    return server;
+}
+
+// Must be called with `server->mutex` locked.
+static void startServer(Server *server, const QString &convPath)
+{
+    // Before the start, so a converter replaced in the meantime restarts it again.
+    const auto converter = RenderCache::converterHash(convPath);
+
+    const auto id = QCryptographicHash::hash(convPath.toUtf8(), QCryptographicHash::Md5).toHex();
+    const QString portFile = Paths::workDir() + "/render-server-" + id + ".port";
+    QFile::remove(portFile);
+
+    QStringList args;
+    args << "-Djava.awt.headless=true"
+         << QString(SRCDIR) + "server/RenderServer.java"
+         << convPath
+         << portFile
+         << QString::number(QCoreApplication::applicationPid());
+
+    qint64 pid = 0;
+    if (!QProcess::startDetached("java", args, Paths::workDir(), &pid)) {
+        throw QString("Failed to start a render server for '%1'.").arg(convPath);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!QFile::exists(portFile)) {
+        if (!isProcessAlive(pid)) {
+            throw QString("Render server for '%1' exited during startup.").arg(convPath);
+        }
+
+        if (timer.elapsed() > StartupTimeout) {
+            killProcess(pid);
+            throw QString("Render server for '%1' was shutdown by timeout.").arg(convPath);
+        }
+
+        QThread::msleep(20);
+    }
+
+    QFile file(portFile);
+    if (!file.open(QFile::ReadOnly)) {
+        killProcess(pid);
+        throw QString("Failed to open %1.").arg(portFile);
+    }
+
+    server->pid = pid;
+    server->port = file.readAll().trimmed().toUShort();
+    server->converter = converter;
+    file.close();
+    file.remove();
+}
+
+static quint16 ensureStarted(const QString &convPath, bool restart)
+{
+    auto server = serverFor(convPath);
+
+    QMutexLocker lock(&server->mutex);
+
+    // A rebuilt converter must not be served by the old classes, since its renders
+    // are cached under the new converter's hash.
+    if (   server->pid != 0
+        && (   restart
+            || !isProcessAlive(server->pid)
+            || server->converter != RenderCache::converterHash(convPath)))
+    {
+        killProcess(server->pid);
+        server->pid = 0;
+    }
+
+    if (server->pid == 0) {
+        startServer(server.data(), convPath);
+    }
+
+    return server->port;
+}
+
+static void markDead(const QString &convPath, quint16 port)
+{
+    auto server = serverFor(convPath);
+
+    QMutexLocker lock(&server->mutex);
+
+    // Another job could have already restarted it.
+    if (server->pid != 0 && server->port == port) {
+        killProcess(server->pid);
+        server->pid = 0;
+    }
+}
+
+// Throws ServerLost when the server dies during the job and `isAlone` is not set.
+static QImage runJob(const QString &convPath, const QStringList &args, const int timeout,
+                     JobStats *stats, const QAtomicInt *cancel, const bool isAlone)
+{
+    const QString fullCmd = convPath + " " + args.join(" ");
+
+    StageTimer stages(stats);
+
+    // The server can't abort a render, so a canceled job keeps its scheduler slot
+    // until the server replies, which is then dropped.
+    bool isCanceled = false;
+    const auto canceled = [&]() {
+        if (stats) {
+            stats->failure = "canceled";
+        }
+
+        return QString("Process '%1' was canceled.").arg(fullCmd);
+    };
+
+    QTcpSocket socket;
+
+    // The server could have been killed between jobs, so try to restart it once.
+    auto port = ensureStarted(convPath, false);
+    socket.connectToHost(QHostAddress::LocalHost, port);
+    if (!socket.waitForConnected(5000)) {
+        port = ensureStarted(convPath, true);
+        socket.connectToHost(QHostAddress::LocalHost, port);
+        if (!socket.waitForConnected(5000)) {
+            throw QString("Failed to connect to the render server for '%1'.").arg(convPath);
+        }
+    }
+
+    stages.lap("connect");
+
+    if (cancel && cancel->loadAcquire() != 0) {
+        throw canceled();
+    }
+
+    socket.write(args.join('\t').toUtf8() + '\n');
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Only a job that was running alone is known to have brought the server down.
+    // A canceled one is not retried.
+    const auto lost = [&]() {
+        if (isCanceled) {
+            throw canceled();
+        }
+
+        if (!isAlone) {
+            throw ServerLost();
+        }
+
+        if (stats) {
+            stats->failure = "crashed";
+        }
+
+        throw QString("Process '%1' was crashed.").arg(fullCmd);
+    };
+
+    // Waits for more data. Throws when the job is timed out or the server died.
+    const auto waitForData = [&]() {
+        const auto left = timeout - timer.elapsed();
+        if (left <= 0) {
+            markDead(convPath, port);
+            if (stats) {
+                stats->failure = "timeout";
+            }
+
+            throw QString("Process '%1' was shutdown by timeout of %2 s.")
+                    .arg(fullCmd).arg(timeout / 1000.0);
+        }
+
+        int wait = int(left);
+        if (cancel && !isCanceled) {
+            isCanceled = cancel->loadAcquire() != 0;
+            if (!isCanceled) {
+                wait = qMin(wait, CancelCheckInterval);
+            }
+        }
+
+        if (!socket.waitForReadyRead(wait)) {
+            if (socket.state() != QAbstractSocket::ConnectedState && socket.bytesAvailable() == 0) {
+                markDead(convPath, port);
+                lost();
+            }
+        }
+    };
+
+    while (!socket.canReadLine()) {
+        waitForData();
+    }
+
+    // The render is done, so the image doesn't have to be transferred.
+    if (isCanceled) {
+        throw canceled();
+    }
+
+    const QString reply = QString::fromUtf8(socket.readLine()).trimmed();
+    const auto fields = reply.split('\t');
+    if (fields.first() != "IMAGE" || fields.size() < 3) {
+        throw QString("Process '%1' failed:\n%2").arg(fullCmd, reply.section('\t', 1));
+    }
+
+    stages.lap("render");
+
+    // The peak RSS of a shared JVM says nothing about a single job, so it's left unknown.
+    if (stats && fields.size() >= 4) {
+        stats->cpuTime = fields.at(3).toLongLong();
+    }
+
+    QImage img = ImagePool::create(QSize(fields.at(1).toInt(), fields.at(2).toInt()),
+                                   QImage::Format_ARGB32);
+    if (img.isNull()) {
+        throw QString("Process '%1' produced an invalid image: %2.").arg(fullCmd, reply);
+    }
+
+    // ARGB32 rows are always tightly packed, so the image can be filled in one go.
+    Q_ASSERT(img.bytesPerLine() == img.width() * 4);
+    auto bits = (char*)img.bits();
+    qint64 left = img.sizeInBytes();
+    while (left > 0) {
+        if (socket.bytesAvailable() == 0) {
+            waitForData();
+        }
+
+        const auto n = socket.read(bits, left);
+        if (n < 0) {
+            markDead(convPath, port);
+            lost();
+        }
+
+        bits += n;
+        left -= n;
+    }
+
+    stages.lap("transfer");
+
+    return img;
+}
+
+QImage RenderServer::run(const QString &convPath, const QStringList &args, const int timeout,
+                         JobStats *stats, const QAtomicInt *cancel)
+{
+    if (!QFileInfo(convPath).isFile()) {
+        throw QString("Converter '%1' not found.").arg(convPath);
+    }
+
+    auto server = serverFor(convPath);
+
+    try {
+        QReadLocker lock(&server->jobsLock);
+        return runJob(convPath, args, timeout, stats, cancel, false);
+    } catch (const ServerLost &) {
+        // Could be caused by any of the jobs that were running at the time,
+        // including a timed out one, so each of them is retried alone.
+    }
+
+    QWriteLocker lock(&server->jobsLock);
+    return runJob(convPath, args, timeout, stats, cancel, true);
+}
+
+void RenderServer::shutdown()
+{
+    QMutexLocker lock(&g_serversMutex);
+
+    for (const auto &server : g_servers) {
+        QMutexLocker serverLock(&server->mutex);
+        if (server->pid != 0) {
+            killProcess(server->pid);
+            server->pid = 0;
+        }
+    }
+
+    g_servers.clear();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QStringList>
+
+struct JobStats;
+
+// Keeps one JVM per converter jar alive and sends render jobs to it,
+// instead of starting `java -jar` for every image. A server is restarted
+// once its jar changes on disk.
+//
+// See `server/RenderServer.java` for the server side.
+class RenderServer
+{
+public:
+    // Runs the converter with the same arguments as `java -jar convPath args`,
+    // where the last argument is the output PNG path.
+    //
+    // The image is received as raw pixels over the job's own connection
+    // and the output file is never read.
+    //
+    // When `stats` is set, records the connect (including a server startup),
+    // render and transfer time and the CPU time of the job. The peak RSS is unknown.
+    //
+    // A job running longer than `timeout` ms kills the server,
+    // since a JVM can't abort a render.
+    //
+    // Throws QString on error. A server that dies while processing a job is restarted
+    // and the job is retried alone, so only the job that brings it down again
+    // is reported as a crash.
+    //
+    // The server can't abort a render, so a canceled job still waits for its reply,
+    // which is dropped. This keeps the job's scheduler slot until the server is done with it.
+    static QImage run(const QString &convPath, const QStringList &args, const int timeout,
+                      JobStats *stats = nullptr, const QAtomicInt *cancel = nullptr);
+
+    static void shutdown();
+};
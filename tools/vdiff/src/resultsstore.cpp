@@ -0,0 +1,247 @@
+#include <QAtomicInt>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include "resultsstore.h"
+
+static const int BusyTimeout = 10000; // ms
+
+static QString columnName(const Backend backend)
+{
+    switch (backend) {
+        case Backend::Batik         : return "batik";
+        case Backend::JSVG          : return "jsvg";
+        case Backend::SVGSalamander : return "svgsalamander";
+        case Backend::EchoSVG       : return "echosvg";
+        default : break;
+    }
+
+    Q_UNREACHABLE();
+}
+
+static const Backend Columns[] = {
+    Backend::Batik, Backend::JSVG, Backend::SVGSalamander, Backend::EchoSVG
+};
+
+static QString newConnectionName()
+{
+    static QAtomicInt id;
+    return QString("results-%1").arg(id.fetchAndAddRelaxed(1));
+}
+
+static void exec(QSqlQuery &query)
+{
+    if (!query.exec()) {
+        throw QString("Results database error: %1").arg(query.lastError().text());
+    }
+}
+
+static void exec(const QSqlDatabase &db, const QString &sql)
+{
+    QSqlQuery query(db);
+    query.prepare(sql);
+    exec(query);
+}
+
+ResultsStore::ResultsStore(const QString &csvPath)
+    : m_csvPath(csvPath)
+    , m_connection(newConnectionName())
+{
+    auto db = QSqlDatabase::addDatabase("QSQLITE", m_connection);
+    db.setDatabaseName(dbPath(csvPath));
+    db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BusyTimeout));
+    if (!db.open()) {
+        const auto msg = db.lastError().text();
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(m_connection);
+        throw QString("Failed to open %1: %2").arg(dbPath(csvPath), msg);
+    }
+
+    exec(db, "PRAGMA journal_mode=WAL");
+    exec(db, "PRAGMA synchronous=NORMAL");
+    exec(db, "CREATE TABLE IF NOT EXISTS results ("
+             "test TEXT PRIMARY KEY, "
+             "position INTEGER NOT NULL, "
+             "batik INTEGER NOT NULL DEFAULT 0, "
+             "jsvg INTEGER NOT NULL DEFAULT 0, "
+             "svgsalamander INTEGER NOT NULL DEFAULT 0, "
+             "echosvg INTEGER NOT NULL DEFAULT 0)");
+    exec(db, "CREATE TABLE IF NOT EXISTS outputs ("
+             "test TEXT NOT NULL, "
+             "backend TEXT NOT NULL, "
+             "view_size INTEGER NOT NULL, "
+             "converter TEXT NOT NULL, "
+             "hash TEXT NOT NULL, "
+             "cache_key TEXT NOT NULL DEFAULT '', "
+             "PRIMARY KEY (test, backend, view_size))");
+}
+
+ResultsStore::~ResultsStore()
+{
+    {
+        auto db = QSqlDatabase::database(m_connection, false);
+        db.close();
+    }
+
+    QSqlDatabase::removeDatabase(m_connection);
+}
+
+QString ResultsStore::dbPath(const QString &csvPath)
+{
+    const QFileInfo fi(csvPath);
+    return fi.absolutePath() + "/" + fi.completeBaseName() + ".sqlite";
+}
+
+bool ResultsStore::isEmpty() const
+{
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.prepare("SELECT COUNT(*) FROM results");
+    exec(query);
+    return !query.next() || query.value(0).toInt() == 0;
+}
+
+QVector<ResultsStore::Row> ResultsStore::load() const
+{
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.setForwardOnly(true);
+    query.prepare("SELECT test, batik, jsvg, svgsalamander, echosvg "
+                  "FROM results ORDER BY position, test");
+    exec(query);
+
+    QVector<Row> rows;
+    while (query.next()) {
+        Row row;
+        row.first = query.value(0).toString();
+        for (int i = 0; i < 4; ++i) {
+            const int state = query.value(i + 1).toInt();
+            row.second.insert(Columns[i], (TestState)qBound(0, state, (int)TestState::Crashed));
+        }
+        rows << row;
+    }
+
+    return rows;
+}
+
+void ResultsStore::setState(const QString &test, const Backend backend, const TestState state)
+{
+    const auto column = columnName(backend);
+
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.prepare(QString("INSERT INTO results (test, position, %1) "
+                          "VALUES (:test, (SELECT IFNULL(MAX(position), -1) + 1 FROM results), "
+                          ":state) "
+                          "ON CONFLICT (test) DO UPDATE SET %1 = excluded.%1").arg(column));
+    query.bindValue(":test", test);
+    query.bindValue(":state", (int)state);
+    exec(query);
+}
+
+void ResultsStore::replace(const Tests &tests)
+{
+    auto db = QSqlDatabase::database(m_connection);
+
+    // Writers are serialized by SQLite, so a concurrent state change either lands before
+    // the transaction or after it, but it's never lost.
+    exec(db, "BEGIN IMMEDIATE");
+    try {
+        exec(db, "UPDATE results SET position = -1");
+
+        QSqlQuery query(db);
+        query.prepare("INSERT INTO results "
+                      "(test, position, batik, jsvg, svgsalamander, echosvg) "
+                      "VALUES (?, ?, ?, ?, ?, ?) "
+                      "ON CONFLICT (test) DO UPDATE SET position = excluded.position");
+
+        int position = 0;
+        for (const TestItem &item : tests) {
+            query.addBindValue(item.baseName);
+            query.addBindValue(position++);
+            for (const auto backend : Columns) {
+                query.addBindValue((int)item.state.value(backend));
+            }
+            exec(query);
+        }
+
+        exec(db, "DELETE FROM results WHERE position = -1");
+        exec(db, "COMMIT");
+    } catch (...) {
+        exec(db, "ROLLBACK");
+        throw;
+    }
+}
+
+void ResultsStore::exportCsv() const
+{
+    QString text = "title,batik,jsvg,svgsalamander,echosvg\n";
+    for (const auto &row : load()) {
+        text += row.first;
+        for (const auto backend : Columns) {
+            text += ',' + QString::number((int)row.second.value(backend));
+        }
+        text += '\n';
+    }
+
+    QSaveFile file(m_csvPath);
+    if (!file.open(QFile::WriteOnly)) {
+        throw QString("Failed to open %1.").arg(m_csvPath);
+    }
+
+    file.write(text.toUtf8());
+    if (!file.commit()) {
+        throw QString("Failed to write %1.").arg(m_csvPath);
+    }
+}
+
+QHash<QString, ResultsStore::Output> ResultsStore::outputs(const Backend backend,
+                                                          const int viewSize) const
+{
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.setForwardOnly(true);
+    query.prepare("SELECT test, converter, hash, cache_key FROM outputs "
+                  "WHERE backend = :backend AND view_size = :view_size");
+    query.bindValue(":backend", columnName(backend));
+    query.bindValue(":view_size", viewSize);
+    exec(query);
+
+    QHash<QString, Output> outputs;
+    while (query.next()) {
+        outputs.insert(query.value(0).toString(), { query.value(1).toString(),
+                                                    query.value(2).toString(),
+                                                    query.value(3).toString() });
+    }
+
+    return outputs;
+}
+
+void ResultsStore::setOutputs(const Backend backend, const int viewSize,
+                              const QHash<QString, Output> &outputs)
+{
+    auto db = QSqlDatabase::database(m_connection);
+
+    exec(db, "BEGIN IMMEDIATE");
+    try {
+        QSqlQuery query(db);
+        query.prepare("INSERT OR REPLACE INTO outputs "
+                      "(test, backend, view_size, converter, hash, cache_key) "
+                      "VALUES (?, ?, ?, ?, ?, ?)");
+
+        for (auto it = outputs.constBegin(); it != outputs.constEnd(); ++it) {
+            query.addBindValue(it.key());
+            query.addBindValue(columnName(backend));
+            query.addBindValue(viewSize);
+            query.addBindValue(it->converter);
+            query.addBindValue(it->hash);
+            query.addBindValue(it->cacheKey);
+            exec(query);
+        }
+
+        exec(db, "COMMIT");
+    } catch (...) {
+        exec(db, "ROLLBACK");
+        throw;
+    }
+}
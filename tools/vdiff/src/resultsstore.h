@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+#include "tests.h"
+
+// Test states in a SQLite database next to the results CSV.
+//
+// The database runs in WAL mode and every state change is a single-row upsert
+// of a single column, so several vdiff instances and scripts can update results at once
+// without overwriting each other. The CSV is imported when the database is created
+// and otherwise is only an export format.
+class ResultsStore
+{
+public:
+    typedef QPair<QString, QHash<Backend, TestState>> Row; // Base name and states.
+
+    // A backend render recorded by the batch mode.
+    struct Output
+    {
+        QString converter; // SHA-1 of the converter.
+        QString hash; // SHA-1 of the pixels.
+        QString cacheKey; // RenderCache key, to find the image itself.
+    };
+
+    // Throws QString on error.
+    explicit ResultsStore(const QString &csvPath);
+    ~ResultsStore();
+
+    static QString dbPath(const QString &csvPath);
+
+    bool isEmpty() const;
+
+    // Rows in the CSV order.
+    QVector<Row> load() const;
+
+    void setState(const QString &test, const Backend backend, const TestState state);
+
+    // Makes the list of tests match `tests`.
+    // States of the tests that are already stored are not touched.
+    void replace(const Tests &tests);
+
+    void exportCsv() const;
+
+    // Test base name -> output.
+    QHash<QString, Output> outputs(const Backend backend, const int viewSize) const;
+    void setOutputs(const Backend backend, const int viewSize,
+                    const QHash<QString, Output> &outputs);
+
+private:
+    const QString m_csvPath;
+    const QString m_connection;
+};
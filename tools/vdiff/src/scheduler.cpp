@@ -0,0 +1,151 @@
+#include <QThread>
+
+#include "settings.h"
+
+#include "scheduler.h"
+
+class SchedulerWorker : public QThread
+{
+public:
+    explicit SchedulerWorker(Scheduler *scheduler)
+        : m_scheduler(scheduler)
+    {}
+
+protected:
+    void run() override
+    {
+        m_scheduler->work();
+    }
+
+private:
+    Scheduler * const m_scheduler;
+};
+
+Scheduler& Scheduler::instance()
+{
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+Scheduler::Scheduler()
+{
+    for (int lane = 0; lane < LanesCount; ++lane) {
+        m_running[lane] = 0;
+    }
+
+    configure(Settings());
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_isStopping = true;
+        m_cond.wakeAll();
+    }
+
+    for (auto *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void Scheduler::configure(const Settings &settings, const int cpuCores)
+{
+    const qint64 MiB = 1024 * 1024;
+    const int cores = qMax(1, cpuCores > 0 ? cpuCores : QThread::idealThreadCount());
+
+    QMutexLocker lock(&m_mutex);
+
+    const auto setLane = [this](const int lane, const int jobs, const qint64 memory) {
+        m_limits[lane] = qMax(1, jobs);
+        m_laneMemory[lane] = memory;
+    };
+
+    const qint64 jvmMemory = settings.jvmJobMemory * MiB;
+    setLane(renderLane(Backend::Reference), cores, 0);
+    setLane(renderLane(Backend::Batik), settings.batikJobs, jvmMemory);
+    setLane(renderLane(Backend::JSVG), settings.jsvgJobs, jvmMemory);
+    setLane(renderLane(Backend::SVGSalamander), settings.svgsalamanderJobs, jvmMemory);
+    setLane(renderLane(Backend::EchoSVG), settings.echosvgJobs, jvmMemory);
+    setLane(DiffLane, cores, 0);
+
+    m_memoryBudget = settings.memoryBudget * MiB;
+
+    // Workers running JVM jobs mostly wait for a converter,
+    // so they don't take cores from the CPU-bound tasks.
+    int workers = cores;
+    for (int lane = renderLane(Backend::Batik); lane <= renderLane(Backend::EchoSVG); ++lane) {
+        workers += m_limits[lane];
+    }
+
+    while (m_workers.size() < workers) {
+        auto worker = new SchedulerWorker(this);
+        worker->start();
+        m_workers << worker;
+    }
+
+    m_cond.wakeAll();
+}
+
+void Scheduler::submit(const Cost &cost, const Priority priority, std::function<void()> fn)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Task task { cost.lane, cost.memory + m_laneMemory[cost.lane], std::move(fn) };
+    m_queues[(int)priority][cost.lane].push_back(std::move(task));
+    m_cond.wakeAll();
+}
+
+// Must be called with `m_mutex` locked.
+bool Scheduler::takeTask(Task *task)
+{
+    for (int p = PrioritiesCount - 1; p >= 0; --p) {
+        for (int i = 0; i < LanesCount; ++i) {
+            // Rotate lanes, so a busy backend doesn't starve the others.
+            const int lane = (m_nextLane + i) % LanesCount;
+            auto &queue = m_queues[p][lane];
+            if (queue.empty() || m_running[lane] >= m_limits[lane]) {
+                continue;
+            }
+
+            // A task larger than the whole budget can still run alone.
+            const auto memory = queue.front().memory;
+            if (m_usedMemory != 0 && m_usedMemory + memory > m_memoryBudget) {
+                continue;
+            }
+
+            *task = std::move(queue.front());
+            queue.pop_front();
+
+            m_running[lane]++;
+            m_usedMemory += memory;
+            m_nextLane = (lane + 1) % LanesCount;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scheduler::work()
+{
+    QMutexLocker lock(&m_mutex);
+
+    while (!m_isStopping) {
+        Task task;
+        if (!takeTask(&task)) {
+            m_cond.wait(&m_mutex);
+            continue;
+        }
+
+        lock.unlock();
+        task.fn();
+        task.fn = nullptr;
+        lock.relock();
+
+        m_running[task.lane]--;
+        m_usedMemory -= task.memory;
+        m_cond.wakeAll();
+    }
+}
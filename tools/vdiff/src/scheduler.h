@@ -0,0 +1,122 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QFutureInterface>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+
+#include "tests.h"
+
+class QThread;
+class Settings;
+
+// Runs render and diff tasks on a dedicated set of workers.
+//
+// Each backend has its own queue and concurrency limit, so JVM jobs can't occupy
+// every worker, and all tasks share a memory budget. Any idle worker takes
+// the next eligible task from any queue, so tasks of different tests
+// are spread over all workers.
+class Scheduler
+{
+public:
+    enum class Priority
+    {
+        Low, // Prefetching.
+        Normal, // Batch mode.
+        High, // The test the user is looking at.
+    };
+
+    struct Cost
+    {
+        int lane;
+        qint64 memory; // Bytes, in addition to the lane's per-job memory.
+    };
+
+    static const int DiffLane = BackendsCount;
+
+    static int renderLane(const Backend backend) { return (int)backend; }
+
+    static Scheduler& instance();
+
+    ~Scheduler();
+
+    // `cores` limits the CPU-bound lanes, all cores when 0.
+    void configure(const Settings &settings, const int cores = 0);
+
+    // Like QtConcurrent::mapped, but scheduled by cost and priority.
+    // Canceling the future skips the tasks that haven't started yet.
+    template <typename Input, typename Output>
+    QFuture<Output> mapped(const QVector<Input> &inputs,
+                           Output (*fn)(const Input &),
+                           Cost (*cost)(const Input &),
+                           const Priority priority);
+
+private:
+    struct Task
+    {
+        int lane;
+        qint64 memory;
+        std::function<void()> fn;
+    };
+
+    static const int LanesCount = BackendsCount + 1;
+    static const int PrioritiesCount = 3;
+
+    Scheduler();
+
+    void submit(const Cost &cost, const Priority priority, std::function<void()> fn);
+    bool takeTask(Task *task);
+    void work();
+
+    friend class SchedulerWorker;
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    bool m_isStopping = false;
+    std::deque<Task> m_queues[PrioritiesCount][LanesCount];
+    int m_limits[LanesCount];
+    qint64 m_laneMemory[LanesCount];
+    int m_running[LanesCount];
+    int m_nextLane = 0;
+    qint64 m_memoryBudget = 0;
+    qint64 m_usedMemory = 0;
+    QVector<QThread*> m_workers;
+};
+
+template <typename Input, typename Output>
+QFuture<Output> Scheduler::mapped(const QVector<Input> &inputs,
+                                  Output (*fn)(const Input &),
+                                  Cost (*cost)(const Input &),
+                                  const Priority priority)
+{
+    auto iface = QSharedPointer<QFutureInterface<Output>>::create();
+    iface->reportStarted();
+    const auto future = iface->future();
+
+    if (inputs.isEmpty()) {
+        iface->reportFinished();
+        return future;
+    }
+
+    auto left = QSharedPointer<QAtomicInt>::create(inputs.size());
+    for (int i = 0; i < inputs.size(); ++i) {
+        const Input input = inputs.at(i);
+        submit(cost(input), priority, [iface, left, fn, input, i]() {
+            if (!iface->isCanceled()) {
+                iface->reportResult(fn(input), i);
+            }
+
+            if (!left->deref()) {
+                iface->reportFinished();
+            }
+        });
+    }
+
+    return future;
+}
@@ -1,3 +1,4 @@
+#include <QColor>
 #include <QSettings>
 #include <QFileInfo>
 
@@ -15,6 +16,25 @@ namespace Key {
     static const QString UseSVGSalamander   = "UseSVGSalamander";
     static const QString UseEchoSVG         = "UseEchoSVG";
     static const QString ViewSize           = "ViewSize";
+    static const QString UseRenderServer    = "UseRenderServer";
+    static const QString UseRenderCache     = "UseRenderCache";
+    static const QString RenderCacheSize    = "RenderCacheSize";
+    static const QString PrefetchCount      = "PrefetchCount";
+    static const QString BatikJobs          = "BatikJobs";
+    static const QString JSVGJobs           = "JSVGJobs";
+    static const QString SVGSalamanderJobs  = "SVGSalamanderJobs";
+    static const QString EchoSVGJobs        = "EchoSVGJobs";
+    static const QString MemoryBudget       = "MemoryBudget";
+    static const QString JvmJobMemory       = "JvmJobMemory";
+    static const QString JobTimeout         = "JobTimeout";
+    static const QString JobMemoryLimit     = "JobMemoryLimit";
+    static const QString AutoClassify       = "AutoClassify";
+    static const QString DiffBackground     = "DiffBackground";
+    static const QString PassRatio          = "PassRatio";
+    static const QString PassSsim           = "PassSsim";
+    static const QString PassMaxDelta       = "PassMaxDelta";
+    static const QString FailRatio          = "FailRatio";
+    static const QString FailSsim           = "FailSsim";
 }
 
 static QString testSuiteToStr(TestSuite t) noexcept
@@ -38,6 +58,8 @@ static TestSuite testSuiteFromStr(const QString &str) noexcept
     Q_UNREACHABLE();
 }
 
+static const TestSuite Suites[] = { TestSuite::Own, TestSuite::Custom };
+
 void Settings::load() noexcept
 {
     QSettings appSettings;
@@ -53,6 +75,35 @@ void Settings::load() noexcept
     this->jsvgPath = appSettings.value(Key::JSVGPath).toString();
     this->svgsalamanderPath = appSettings.value(Key::SVGSalamanderPath).toString();
     this->echosvgPath = appSettings.value(Key::EchoSVGPath).toString();
+
+    this->useRenderServer = appSettings.value(Key::UseRenderServer, true).toBool();
+    this->useRenderCache = appSettings.value(Key::UseRenderCache, true).toBool();
+    this->renderCacheSize = appSettings.value(Key::RenderCacheSize, 512).toInt();
+    this->prefetchCount = appSettings.value(Key::PrefetchCount, 3).toInt();
+    this->batikJobs = appSettings.value(Key::BatikJobs, 2).toInt();
+    this->jsvgJobs = appSettings.value(Key::JSVGJobs, 2).toInt();
+    this->svgsalamanderJobs = appSettings.value(Key::SVGSalamanderJobs, 2).toInt();
+    this->echosvgJobs = appSettings.value(Key::EchoSVGJobs, 2).toInt();
+    this->memoryBudget = appSettings.value(Key::MemoryBudget, 4096).toInt();
+    this->jvmJobMemory = appSettings.value(Key::JvmJobMemory, 512).toInt();
+    this->jobTimeout = appSettings.value(Key::JobTimeout, 120).toInt();
+    this->jobMemoryLimit = appSettings.value(Key::JobMemoryLimit, 2048).toInt();
+    this->autoClassify = appSettings.value(Key::AutoClassify, false).toBool();
+    const auto diffBackground = appSettings.value(Key::DiffBackground, "#ffffff").toString();
+    this->diffBackground = QColor(diffBackground).rgb();
+
+    // Each suite has its own policy, since their references are made differently.
+    for (const auto suite : Suites) {
+        const ClassifyPolicy def;
+        auto &policy = this->policies[(int)suite];
+        appSettings.beginGroup(testSuiteToStr(suite));
+        policy.passRatio = appSettings.value(Key::PassRatio, def.passRatio).toDouble();
+        policy.passSsim = appSettings.value(Key::PassSsim, def.passSsim).toDouble();
+        policy.passMaxDelta = appSettings.value(Key::PassMaxDelta, def.passMaxDelta).toInt();
+        policy.failRatio = appSettings.value(Key::FailRatio, def.failRatio).toDouble();
+        policy.failSsim = appSettings.value(Key::FailSsim, def.failSsim).toDouble();
+        appSettings.endGroup();
+    }
 }
 
 void Settings::save() const noexcept
@@ -69,6 +120,31 @@ void Settings::save() const noexcept
     appSettings.setValue(Key::JSVGPath, this->jsvgPath);
     appSettings.setValue(Key::EchoSVGPath, this->echosvgPath);
     appSettings.setValue(Key::SVGSalamanderPath, this->svgsalamanderPath);
+    appSettings.setValue(Key::UseRenderServer, this->useRenderServer);
+    appSettings.setValue(Key::UseRenderCache, this->useRenderCache);
+    appSettings.setValue(Key::RenderCacheSize, this->renderCacheSize);
+    appSettings.setValue(Key::PrefetchCount, this->prefetchCount);
+    appSettings.setValue(Key::BatikJobs, this->batikJobs);
+    appSettings.setValue(Key::JSVGJobs, this->jsvgJobs);
+    appSettings.setValue(Key::SVGSalamanderJobs, this->svgsalamanderJobs);
+    appSettings.setValue(Key::EchoSVGJobs, this->echosvgJobs);
+    appSettings.setValue(Key::MemoryBudget, this->memoryBudget);
+    appSettings.setValue(Key::JvmJobMemory, this->jvmJobMemory);
+    appSettings.setValue(Key::JobTimeout, this->jobTimeout);
+    appSettings.setValue(Key::JobMemoryLimit, this->jobMemoryLimit);
+    appSettings.setValue(Key::AutoClassify, this->autoClassify);
+    appSettings.setValue(Key::DiffBackground, QColor(this->diffBackground).name());
+
+    for (const auto suite : Suites) {
+        const auto &policy = this->policies[(int)suite];
+        appSettings.beginGroup(testSuiteToStr(suite));
+        appSettings.setValue(Key::PassRatio, policy.passRatio);
+        appSettings.setValue(Key::PassSsim, policy.passSsim);
+        appSettings.setValue(Key::PassMaxDelta, policy.passMaxDelta);
+        appSettings.setValue(Key::FailRatio, policy.failRatio);
+        appSettings.setValue(Key::FailSsim, policy.failSsim);
+        appSettings.endGroup();
+    }
 }
 
 QString Settings::resultsPath() const noexcept
@@ -81,6 +157,13 @@ QString Settings::resultsPath() const noexcept
     return QFileInfo(path).absoluteFilePath();
 }
 
+// Job timings are kept next to the results, see TimingsLog.
+QString Settings::timingsPath() const noexcept
+{
+    const QFileInfo results(resultsPath());
+    return results.absolutePath() + "/" + results.completeBaseName() + "-timings.csv";
+}
+
 QString Settings::testsPath() const noexcept
 {
     QString path;
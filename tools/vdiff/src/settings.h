@@ -1,7 +1,9 @@
 #pragma once
 
+#include <QRgb>
 #include <QString>
 
+#include "classifier.h"
 #include "tests.h"
 
 class Settings
@@ -12,6 +14,10 @@ public:
 
     QString resultsPath() const noexcept;
     QString testsPath() const noexcept;
+    QString timingsPath() const noexcept;
+
+    // The classification policy of the current test suite.
+    const ClassifyPolicy& policy() const noexcept { return policies[(int)testSuite]; }
 
 public:
     TestSuite testSuite = TestSuite::Own;
@@ -25,4 +31,19 @@ public:
     QString jsvgPath;
     QString svgsalamanderPath;
     QString echosvgPath;
+    bool useRenderServer = true;
+    bool useRenderCache = true;
+    int renderCacheSize = 512; // MiB
+    int prefetchCount = 3;
+    int batikJobs = 2;
+    int jsvgJobs = 2;
+    int svgsalamanderJobs = 2;
+    int echosvgJobs = 2;
+    int memoryBudget = 4096; // MiB
+    int jvmJobMemory = 512; // MiB
+    int jobTimeout = 120; // s, of a test without render history.
+    int jobMemoryLimit = 2048; // MiB, 0 for none.
+    bool autoClassify = false; // Verdicts are stored like manual reviews.
+    QRgb diffBackground = 0xffffffff; // Transparent pixels are compared over it.
+    ClassifyPolicy policies[2]; // Indexed by TestSuite.
 };
@@ -2,11 +2,15 @@
 #include <QFileDialog>
 #include <QMessageBox>
 
+#include "rendercache.h"
 #include "settings.h"
 
 #include "settingsdialog.h"
 #include "ui_settingsdialog.h"
 
+// Indexed by the items of comboBoxDiffBackground.
+static const QRgb DiffBackgrounds[] = { 0xffffffff, 0xff000000 };
+
 SettingsDialog::SettingsDialog(Settings *settings, QWidget *parent)
     : QDialog(parent)
     , ui(new Ui::SettingsDialog)
@@ -23,6 +27,8 @@ SettingsDialog::SettingsDialog(Settings *settings, QWidget *parent)
     suiteGroup->addButton(ui->rBtnSuiteCustom);
     connect(suiteGroup, SIGNAL(buttonToggled(QAbstractButton*,bool)),
             this, SLOT(prepareTestsPathWidgets()));
+    connect(suiteGroup, SIGNAL(buttonToggled(QAbstractButton*,bool)),
+            this, SLOT(onSuiteChanged()));
 
     ui->buttonBox->setFocus();
 }
@@ -49,9 +55,70 @@ void SettingsDialog::loadSettings()
     ui->chBoxUseEchoSVG->setChecked(m_settings->useEchoSVG);
     ui->lineEditEchoSVG->setText(m_settings->echosvgPath);
 
+    ui->chBoxUseRenderServer->setChecked(m_settings->useRenderServer);
+    ui->chBoxUseRenderCache->setChecked(m_settings->useRenderCache);
+    ui->spinBoxCacheSize->setValue(m_settings->renderCacheSize);
+    ui->spinBoxPrefetch->setValue(m_settings->prefetchCount);
+    ui->spinBoxBatikJobs->setValue(m_settings->batikJobs);
+    ui->spinBoxJSVGJobs->setValue(m_settings->jsvgJobs);
+    ui->spinBoxSVGSalamanderJobs->setValue(m_settings->svgsalamanderJobs);
+    ui->spinBoxEchoSVGJobs->setValue(m_settings->echosvgJobs);
+    ui->spinBoxMemoryBudget->setValue(m_settings->memoryBudget);
+    ui->spinBoxJvmJobMemory->setValue(m_settings->jvmJobMemory);
+    ui->spinBoxJobTimeout->setValue(m_settings->jobTimeout);
+    ui->spinBoxJobMemoryLimit->setValue(m_settings->jobMemoryLimit);
+
+    ui->chBoxAutoClassify->setChecked(m_settings->autoClassify);
+    for (int i = 0; i < ui->comboBoxDiffBackground->count(); ++i) {
+        if (DiffBackgrounds[i] == m_settings->diffBackground) {
+            ui->comboBoxDiffBackground->setCurrentIndex(i);
+        }
+    }
+    m_policies[0] = m_settings->policies[0];
+    m_policies[1] = m_settings->policies[1];
+    m_policySuite = selectedSuite();
+    loadPolicy();
+
     prepareTestsPathWidgets();
 }
 
+TestSuite SettingsDialog::selectedSuite() const
+{
+    return ui->rBtnSuiteCustom->isChecked() ? TestSuite::Custom : TestSuite::Own;
+}
+
+void SettingsDialog::loadPolicy()
+{
+    const auto &policy = m_policies[(int)m_policySuite];
+    ui->dSpinBoxPassRatio->setValue(policy.passRatio * 100);
+    ui->dSpinBoxPassSsim->setValue(policy.passSsim);
+    ui->spinBoxPassMaxDelta->setValue(policy.passMaxDelta);
+    ui->dSpinBoxFailRatio->setValue(policy.failRatio * 100);
+    ui->dSpinBoxFailSsim->setValue(policy.failSsim);
+}
+
+void SettingsDialog::storePolicy()
+{
+    auto &policy = m_policies[(int)m_policySuite];
+    policy.passRatio = ui->dSpinBoxPassRatio->value() / 100;
+    policy.passSsim = ui->dSpinBoxPassSsim->value();
+    policy.passMaxDelta = ui->spinBoxPassMaxDelta->value();
+    policy.failRatio = ui->dSpinBoxFailRatio->value() / 100;
+    policy.failSsim = ui->dSpinBoxFailSsim->value();
+}
+
+// Each suite has its own thresholds.
+void SettingsDialog::onSuiteChanged()
+{
+    if (selectedSuite() == m_policySuite) {
+        return;
+    }
+
+    storePolicy();
+    m_policySuite = selectedSuite();
+    loadPolicy();
+}
+
 void SettingsDialog::prepareTestsPathWidgets()
 {
     const auto isCustom = ui->rBtnSuiteCustom->isChecked();
@@ -61,11 +128,7 @@ void SettingsDialog::prepareTestsPathWidgets()
 
 void SettingsDialog::on_buttonBox_accepted()
 {
-    auto suite = TestSuite::Own;
-    if (ui->rBtnSuiteCustom->isChecked()) {
-        suite = TestSuite::Custom;
-    }
-    m_settings->testSuite = suite;
+    m_settings->testSuite = selectedSuite();
     m_settings->customTestsPath = ui->lineEditTestsPath->text();
 
     m_settings->useBatik = ui->chBoxUseBatik->isChecked();
@@ -73,10 +136,38 @@ void SettingsDialog::on_buttonBox_accepted()
     m_settings->useSVGSalamander = ui->chBoxUseSVGSalamander->isChecked();
     m_settings->useEchoSVG = ui->chBoxUseEchoSVG->isChecked();
 
-    m_settings->batikPath = ui->lineEditBatik->text();
-    m_settings->jsvgPath = ui->lineEditJSVG->text();
-    m_settings->svgsalamanderPath = ui->lineEditSVGSalamander->text();
-    m_settings->echosvgPath = ui->lineEditEchoSVG->text();
+    // Renders of a replaced converter will never be used again.
+    const auto updateConverter = [](QString &path, const QString &newPath, const Backend backend) {
+        if (path != newPath) {
+            RenderCache::invalidate(backend);
+            path = newPath;
+        }
+    };
+
+    updateConverter(m_settings->batikPath, ui->lineEditBatik->text(), Backend::Batik);
+    updateConverter(m_settings->jsvgPath, ui->lineEditJSVG->text(), Backend::JSVG);
+    updateConverter(m_settings->svgsalamanderPath, ui->lineEditSVGSalamander->text(),
+                    Backend::SVGSalamander);
+    updateConverter(m_settings->echosvgPath, ui->lineEditEchoSVG->text(), Backend::EchoSVG);
+
+    m_settings->useRenderServer = ui->chBoxUseRenderServer->isChecked();
+    m_settings->useRenderCache = ui->chBoxUseRenderCache->isChecked();
+    m_settings->renderCacheSize = ui->spinBoxCacheSize->value();
+    m_settings->prefetchCount = ui->spinBoxPrefetch->value();
+    m_settings->batikJobs = ui->spinBoxBatikJobs->value();
+    m_settings->jsvgJobs = ui->spinBoxJSVGJobs->value();
+    m_settings->svgsalamanderJobs = ui->spinBoxSVGSalamanderJobs->value();
+    m_settings->echosvgJobs = ui->spinBoxEchoSVGJobs->value();
+    m_settings->memoryBudget = ui->spinBoxMemoryBudget->value();
+    m_settings->jvmJobMemory = ui->spinBoxJvmJobMemory->value();
+    m_settings->jobTimeout = ui->spinBoxJobTimeout->value();
+    m_settings->jobMemoryLimit = ui->spinBoxJobMemoryLimit->value();
+
+    m_settings->autoClassify = ui->chBoxAutoClassify->isChecked();
+    m_settings->diffBackground = DiffBackgrounds[ui->comboBoxDiffBackground->currentIndex()];
+    storePolicy();
+    m_settings->policies[0] = m_policies[0];
+    m_settings->policies[1] = m_policies[1];
 
     m_settings->save();
 }
@@ -90,6 +181,13 @@ void SettingsDialog::on_btnSelectTest_clicked()
     }
 }
 
+void SettingsDialog::on_btnClearCache_clicked()
+{
+    for (int t = (int)Backend::Batik; t <= (int)Backend::EchoSVG; ++t) {
+        RenderCache::invalidate((Backend)t);
+    }
+}
+
 void SettingsDialog::on_btnSelectBatik_clicked()
 {
     const auto path = QFileDialog::getOpenFileName(this, "batik-rasterizer exe path");
@@ -2,6 +2,9 @@
 
 #include <QDialog>
 
+#include "classifier.h"
+#include "tests.h"
+
 namespace Ui {
 class SettingsDialog;
 }
@@ -18,6 +21,9 @@ public:
 
 private:
     void loadSettings();
+    TestSuite selectedSuite() const;
+    void loadPolicy();
+    void storePolicy();
 
 private slots:
     void on_buttonBox_accepted();
@@ -26,9 +32,13 @@ private slots:
     void on_btnSelectSVGSalamander_clicked();
     void on_btnSelectEchoSVG_clicked();
     void on_btnSelectTest_clicked();
+    void on_btnClearCache_clicked();
     void prepareTestsPathWidgets();
+    void onSuiteChanged();
 
 private:
     Ui::SettingsDialog * const ui;
     Settings * const m_settings;
+    ClassifyPolicy m_policies[2]; // Edited copies, indexed by TestSuite.
+    TestSuite m_policySuite = TestSuite::Own; // The suite of the shown policy.
 };
@@ -0,0 +1,179 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QFontMetrics>
+#include <QPainter>
+#include <QRegularExpression>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include "render.h"
+#include "scheduler.h"
+
+#include "sheet.h"
+
+namespace {
+
+struct BuildSheet
+{
+    typedef QString result_type;
+
+    Settings settings;
+    QHash<Backend, QString> titles;
+    ExportDialog::Options opt;
+    QString dir;
+    int scale;
+    QSharedPointer<QAtomicInt> cancel;
+
+    QString operator()(const TestItem &item) const;
+};
+
+}
+
+QImage Sheet::paint(const QString &testName, const QVector<Column> &columns,
+                    const ExportDialog::Options &opt, const int viewSize, const int scale)
+{
+    const QFont testTitleFont("Arial", 14);
+
+    const int count = columns.size();
+    const int titleHeight = 20;
+    const int spacing = 5;
+    const int testTitleHeight = QFontMetrics(testTitleFont).height() * 2;
+    const int fullWidth = viewSize * count + spacing * (count + 1);
+    int fullHeight = titleHeight + viewSize + spacing * 2;
+
+    if (opt.showTitle) {
+        fullHeight += testTitleHeight;
+    }
+
+    if (opt.showDiff) {
+        fullHeight += spacing + viewSize;
+    }
+
+    QImage image(fullWidth * scale, fullHeight * scale, QImage::Format_ARGB32);
+    image.fill(Qt::white);
+    image.setDevicePixelRatio(scale);
+
+    QPainter p(&image);
+
+    if (opt.showTitle) {
+        const QRect textRect(0, 0, fullWidth, testTitleHeight);
+        p.setFont(testTitleFont);
+        p.drawText(textRect, Qt::AlignCenter, "Test file: " + testName);
+        p.translate(0, testTitleHeight);
+    }
+
+    p.setFont(QFont("Arial", 12));
+
+    int x = spacing;
+    int y = spacing;
+    for (const auto &column : columns) {
+        const auto textRect = QRect(x, y, viewSize, titleHeight - 3);
+        p.setPen(Qt::black);
+        p.drawText(textRect, Qt::AlignCenter, column.title);
+
+        const auto &img = column.image;
+        p.drawImage(x, y + titleHeight, img);
+
+        if (opt.indicateStatus) {
+            switch (column.state) {
+                case TestState::Unknown : p.setPen(Qt::gray); break;
+                case TestState::Passed  : p.setPen(Qt::green); break;
+                case TestState::Failed  : p.setPen(Qt::red); break;
+                case TestState::Crashed : p.setPen(Qt::yellow); break;
+            }
+
+            p.drawRect(x, y + titleHeight, img.width() / scale, img.height() / scale);
+        }
+
+        if (opt.showDiff && !column.diff.isNull()) {
+            p.drawImage(x, y + titleHeight + viewSize + spacing, column.diff);
+        }
+
+        x += viewSize + spacing;
+    }
+
+    p.end();
+
+    return image;
+}
+
+QString Sheet::fileName(const TestItem &item)
+{
+    // File names repeat across groups, so the directories are kept in the name.
+    const QFileInfo info(item.baseName);
+    auto name = info.completeBaseName();
+    if (info.path() != ".") {
+        name.prepend(info.path() + '/');
+    }
+
+    static const QRegularExpression invalidChars("[^A-Za-z0-9_.-]");
+    return name.replace(invalidChars, "_") + ".png";
+}
+
+// Only the selected backends are rendered. Unchanged ones are usually in the render cache.
+QString BuildSheet::operator()(const TestItem &item) const
+{
+    if (cancel->loadAcquire() != 0) {
+        return QString();
+    }
+
+    auto jobs = Render::prepareJobs(settings, item.path, settings.viewSize * scale);
+    for (int i = jobs.size() - 1; i >= 0; --i) {
+        const auto type = jobs.at(i).type;
+        const bool isRef = type == Backend::Reference;
+        if (!opt.backends.contains(type) && !(isRef && opt.showDiff)) {
+            jobs.remove(i);
+        } else {
+            jobs[i].cancel = cancel;
+        }
+    }
+
+    // This thread only waits, like a batch run.
+    const auto results = Scheduler::instance().mapped(jobs, &Render::renderImage,
+                                                      &Render::renderCost,
+                                                      Scheduler::Priority::Normal).results();
+    if (cancel->loadAcquire() != 0) {
+        return QString();
+    }
+
+    QHash<Backend, RenderResult> rendered;
+    for (const auto &res : results) {
+        rendered.insert(res.type, res);
+    }
+
+    QVector<Sheet::Column> columns;
+    for (const auto backend : opt.backends) {
+        if (!rendered.contains(backend)) {
+            continue;
+        }
+
+        const auto &res = rendered.value(backend);
+        Sheet::Column column { titles.value(backend), res.img, QImage(),
+                               item.state.value(backend) };
+
+        const auto ref = rendered.value(Backend::Reference);
+        if (   opt.showDiff && backend != Backend::Reference
+            && res.error.isEmpty() && !ref.img.isNull() && ref.error.isEmpty())
+        {
+            column.diff = Render::diffImage({ backend, ref.img, res.img,
+                                              settings.diffBackground }).img;
+        }
+
+        columns << column;
+    }
+
+    const auto image = Sheet::paint(item.baseName, columns, opt, settings.viewSize, scale);
+    const auto path = QDir(dir).absoluteFilePath(Sheet::fileName(item));
+    if (!image.save(path)) {
+        return QString("Failed to write '%1'.").arg(path);
+    }
+
+    return QString();
+}
+
+QFuture<QString> Sheet::exportAll(const Settings &settings, const QVector<TestItem> &tests,
+                                  const QHash<Backend, QString> &titles,
+                                  const ExportDialog::Options &opt, const QString &dir,
+                                  const int scale, const QSharedPointer<QAtomicInt> &cancel)
+{
+    return QtConcurrent::mapped(tests, BuildSheet { settings, titles, opt, dir, scale, cancel });
+}
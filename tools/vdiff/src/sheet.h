@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QImage>
+#include <QSharedPointer>
+
+#include "exportdialog.h"
+#include "settings.h"
+
+// A comparison sheet of a test: backend images side by side with optional diffs below.
+class Sheet
+{
+public:
+    struct Column
+    {
+        QString title;
+        QImage image;
+        QImage diff; // Optional.
+        TestState state;
+    };
+
+    // Images are `viewSize * scale` pixels wide. Can be called from any thread.
+    static QImage paint(const QString &testName, const QVector<Column> &columns,
+                        const ExportDialog::Options &opt, const int viewSize, const int scale);
+
+    // Renders, paints and saves the sheets of `tests` into `dir` in parallel.
+    // Results are error messages, empty on success.
+    //
+    // Canceling the future skips the remaining tests, while `cancel` stops
+    // the converters of the current ones.
+    static QFuture<QString> exportAll(const Settings &settings, const QVector<TestItem> &tests,
+                                      const QHash<Backend, QString> &titles,
+                                      const ExportDialog::Options &opt, const QString &dir,
+                                      const int scale, const QSharedPointer<QAtomicInt> &cancel);
+
+    // The file name of a test sheet, unique within the suite, e.g. `structure_style_inherit.png`.
+    static QString fileName(const TestItem &item);
+};
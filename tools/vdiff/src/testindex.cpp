@@ -0,0 +1,338 @@
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QUrl>
+#include <QXmlStreamReader>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+
+#include "paths.h"
+
+#include "testindex.h"
+
+namespace {
+
+struct Record
+{
+    qint64 size;
+    qint64 mtime; // ms
+    TestMeta meta;
+};
+
+QDataStream& operator<<(QDataStream &s, const Record &r)
+{
+    return s << r.size << r.mtime << r.meta.title << r.meta.size << r.meta.viewBox
+             << r.meta.resources << r.meta.features << r.meta.hash;
+}
+
+QDataStream& operator>>(QDataStream &s, Record &r)
+{
+    return s >> r.size >> r.mtime >> r.meta.title >> r.meta.size >> r.meta.viewBox
+             >> r.meta.resources >> r.meta.features >> r.meta.hash;
+}
+
+typedef QHash<QString, Record> Index; // Absolute path -> record.
+
+struct ParseTest
+{
+    typedef Record result_type;
+
+    const Index &prev;
+
+    Record operator()(const QString &path) const;
+};
+
+QMutex g_mutex; // Never held while parsing or saving.
+QMutex g_saveMutex;
+Index g_index;
+bool g_isLoaded = false;
+bool g_isChanged = false;
+QElapsedTimer g_lastSave;
+
+}
+
+static const quint32 IndexMagic = 0x76646d69; // vdmi
+static const quint32 IndexVersion = 1;
+
+// Of the tests parsed by `get`.
+static const int SaveInterval = 10000; // ms
+
+static QString indexPath()
+{
+    return Paths::workDir() + "/test-metadata.index";
+}
+
+static qint64 mtime(const QFileInfo &fi)
+{
+    return fi.lastModified().toMSecsSinceEpoch();
+}
+
+static Index loadIndex()
+{
+    QFile file(indexPath());
+    if (!file.open(QFile::ReadOnly)) {
+        return Index();
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion) {
+        return Index();
+    }
+
+    Index index;
+    stream >> index;
+    if (stream.status() != QDataStream::Ok) {
+        return Index();
+    }
+
+    return index;
+}
+
+static void saveIndex(const Index &index)
+{
+    QSaveFile file(indexPath());
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Failed to write" << indexPath();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << IndexMagic << IndexVersion << index;
+    file.commit();
+}
+
+// Must be called with `g_mutex` locked.
+static void ensureLoaded()
+{
+    if (!g_isLoaded) {
+        g_index = loadIndex();
+        g_isLoaded = true;
+        g_lastSave.start();
+    }
+}
+
+// Saves a snapshot, so lookups are not blocked by the disk.
+// Must be called with `g_mutex` unlocked.
+static void saveSnapshot()
+{
+    QMutexLocker saveLock(&g_saveMutex);
+
+    Index snapshot;
+    {
+        QMutexLocker lock(&g_mutex);
+        snapshot = g_index;
+        g_isChanged = false;
+        g_lastSave.restart();
+    }
+
+    saveIndex(snapshot);
+}
+
+// Local files referenced via `href` or `url()`, like images, fonts and stylesheets.
+static QStringList referencedFiles(const QByteArray &svg, const QString &dir)
+{
+    static const QRegularExpression re(R"((?:href\s*=\s*["']|url\(\s*["']?)([^"'#)\s][^"')]*))");
+
+    QStringList files;
+    auto it = re.globalMatch(QString::fromUtf8(svg));
+    while (it.hasNext()) {
+        const auto link = it.next().captured(1);
+        if (link.startsWith("data:") || link.contains("://")) {
+            continue;
+        }
+
+        const auto path = QDir(dir).absoluteFilePath(QUrl::fromPercentEncoding(link.toUtf8()));
+        if (QFileInfo(path).isFile() && !files.contains(path)) {
+            files << path;
+        }
+    }
+
+    return files;
+}
+
+static QSize parseSize(const QXmlStreamAttributes &attributes)
+{
+    const auto viewBoxStr = attributes.value("viewBox");
+    const auto widthStr = attributes.value("width");
+    const auto heightStr = attributes.value("height");
+
+    const auto vbValues = viewBoxStr.split(' ');
+    if (vbValues.size() != 4) {
+        return QSize();
+    }
+
+    auto width = widthStr.isEmpty() ? vbValues[2].toDouble() : widthStr.toDouble();
+    auto height = heightStr.isEmpty() ? vbValues[3].toDouble() : heightStr.toDouble();
+
+    return QSize(width, height);
+}
+
+static void parseSvg(const QByteArray &svg, TestMeta *meta)
+{
+    QSet<QString> features;
+    bool isRoot = true;
+    QXmlStreamReader reader(svg);
+    while (!reader.atEnd() && !reader.hasError()) {
+        if (!reader.readNextStartElement()) {
+            continue;
+        }
+
+        const auto name = reader.name().toString();
+        features.insert(name);
+
+        if (isRoot) {
+            isRoot = false;
+            if (name != QLatin1String("svg")) {
+                break;
+            }
+
+            meta->size = parseSize(reader.attributes());
+            meta->viewBox = reader.attributes().value("viewBox").toString();
+        } else if (name == QLatin1String("title") && meta->title.isEmpty()) {
+            reader.readNext();
+            meta->title = reader.text().toString();
+        }
+    }
+
+    meta->features = features.values();
+    std::sort(meta->features.begin(), meta->features.end());
+}
+
+// The file is mapped instead of read, since most of the time only its hash is needed.
+Record ParseTest::operator()(const QString &path) const
+{
+    const QFileInfo fi(path);
+    Record record { fi.size(), mtime(fi), TestMeta() };
+
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return record;
+    }
+
+    QByteArray svg;
+    uchar *data = file.size() > 0 ? file.map(0, file.size()) : nullptr;
+    if (data) {
+        svg = QByteArray::fromRawData((const char*)data, int(file.size()));
+    } else {
+        svg = file.readAll();
+    }
+
+    record.meta.hash = QCryptographicHash::hash(svg, QCryptographicHash::Sha1);
+
+    // Touched, but not changed.
+    const auto old = prev.constFind(path);
+    if (old != prev.constEnd() && old->meta.hash == record.meta.hash) {
+        record.meta = old->meta;
+    } else {
+        parseSvg(svg, &record.meta);
+        record.meta.resources = referencedFiles(svg, fi.absolutePath());
+    }
+
+    svg.clear();
+    if (data) {
+        file.unmap(data);
+    }
+
+    return record;
+}
+
+static bool isUpToDate(const Record &record, const QFileInfo &fi)
+{
+    return record.size == fi.size() && record.mtime == mtime(fi);
+}
+
+void TestIndex::update(const QStringList &paths)
+{
+    QStringList outdated;
+    Index prev;
+    {
+        QMutexLocker lock(&g_mutex);
+        ensureLoaded();
+
+        for (const auto &path : paths) {
+            const auto it = g_index.constFind(path);
+            if (it == g_index.constEnd() || !isUpToDate(*it, QFileInfo(path))) {
+                outdated << path;
+            }
+        }
+
+        prev = g_index;
+    }
+
+    if (outdated.isEmpty()) {
+        return;
+    }
+
+    const auto records = QtConcurrent::blockingMapped<QVector<Record>>(outdated,
+                                                                        ParseTest { prev });
+    {
+        QMutexLocker lock(&g_mutex);
+        for (int i = 0; i < outdated.size(); ++i) {
+            g_index.insert(outdated.at(i), records.at(i));
+        }
+    }
+
+    saveSnapshot();
+}
+
+TestMeta TestIndex::get(const QString &path)
+{
+    const QFileInfo fi(path);
+
+    Index prev; // Only the outdated record, if any.
+    {
+        QMutexLocker lock(&g_mutex);
+        ensureLoaded();
+
+        const auto it = g_index.constFind(path);
+        if (it != g_index.constEnd()) {
+            if (isUpToDate(*it, fi)) {
+                return it->meta;
+            }
+
+            prev.insert(path, *it);
+        }
+    }
+
+    const auto record = ParseTest { prev }(path);
+
+    bool isSaveRequired = false;
+    {
+        QMutexLocker lock(&g_mutex);
+        g_index.insert(path, record);
+        g_isChanged = true;
+        isSaveRequired = g_lastSave.elapsed() > SaveInterval;
+    }
+
+    if (isSaveRequired) {
+        saveSnapshot();
+    }
+
+    return record.meta;
+}
+
+void TestIndex::save()
+{
+    bool isChanged = false;
+    {
+        QMutexLocker lock(&g_mutex);
+        isChanged = g_isChanged;
+    }
+
+    if (isChanged) {
+        saveSnapshot();
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QByteArray>
+#include <QSize>
+#include <QStringList>
+
+// What vdiff needs to know about a test without opening it.
+struct TestMeta
+{
+    QString title;
+    QSize size; // From `width`/`height` or `viewBox`, empty when there is no `viewBox`.
+    QString viewBox;
+    QStringList resources; // Absolute paths of the local files referenced via `href` or `url()`.
+    QStringList features; // Sorted names of the used elements.
+    QByteArray hash; // SHA-1 of the content, empty when the file can't be read.
+};
+
+// Persistent index of test metadata in `Paths::workDir()`.
+//
+// Entries are invalidated by the file size and mtime. A file with a new mtime,
+// but the same content hash, is not parsed again.
+class TestIndex
+{
+public:
+    // Parses new and changed tests in parallel and saves the index.
+    static void update(const QStringList &paths);
+
+    // Parses the test when it isn't indexed yet or was changed.
+    // New entries are saved at most every 10 s.
+    static TestMeta get(const QString &path);
+
+    // Saves the entries added by `get`, if any.
+    static void save();
+};
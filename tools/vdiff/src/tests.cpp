@@ -1,10 +1,19 @@
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
 #include <QFile>
 #include <QDir>
 #include <QDirIterator>
-#include <QXmlStreamReader>
+#include <QMultiHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QSharedPointer>
 #include <QDebug>
 
+#include "paths.h"
+#include "resultsstore.h"
 #include "settings.h"
+#include "testindex.h"
 
 #include "tests.h"
 
@@ -28,28 +37,6 @@ static TestState stateFormStr(const QString &str)
     }
 }
 
-static QString parseTitle(const QString &path)
-{
-    QFile file(path);
-    if (!file.open(QFile::ReadOnly)) {
-        return QString();
-    }
-
-    QString title;
-    QXmlStreamReader reader(&file);
-    while (!reader.atEnd() && !reader.hasError()) {
-        if (reader.readNextStartElement()) {
-            if (reader.name() == QLatin1String("title")) {
-                reader.readNext();
-                title = reader.text().toString();
-                break;
-            }
-        }
-    }
-
-    return title;
-}
-
 static QString resolveBaseName(const QFileInfo &info)
 {
     auto baseName = info.fileName();
@@ -74,7 +61,8 @@ static QString resolveBaseNameCustom(const QFileInfo &info)
     return baseName;
 }
 
-Tests Tests::load(const TestSuite testSuite, const QString &path, const QString &testsPath)
+// Reads the CSV, which is imported into the results database on first use.
+static Tests parseResults(const QString &path, const QString &testsPath)
 {
     QFile file(path);
     if (!file.open(QFile::ReadOnly)) {
@@ -118,11 +106,7 @@ Tests Tests::load(const TestSuite testSuite, const QString &path, const QString
         item.state.insert(Backend::SVGSalamander,  stateFormStr(items.at(3)));
         item.state.insert(Backend::EchoSVG,  stateFormStr(items.at(4)));
 
-        if (testSuite == TestSuite::Own) {
-            item.title = parseTitle(testPath);
-        }
-
-        tests.m_data << item;
+        tests.append(item);
 
         row++;
     }
@@ -130,6 +114,50 @@ Tests Tests::load(const TestSuite testSuite, const QString &path, const QString
     return tests;
 }
 
+// Titles come from the metadata index, so they are skipped when not needed.
+static Tests loadStore(const ResultsStore &store, const QString &testsPath, const bool withTitles)
+{
+    Tests tests;
+    QStringList paths;
+    for (const auto &row : store.load()) {
+        const auto testPath = testsPath + '/' + row.first;
+
+        TestItem item;
+        item.path = QFileInfo(testPath).absoluteFilePath();
+        item.baseName = resolveBaseName(QFileInfo(testPath));
+        item.state = row.second;
+
+        tests.append(item);
+        paths << item.path;
+    }
+
+    if (withTitles) {
+        TestIndex::update(paths);
+        for (int i = 0; i < tests.size(); ++i) {
+            tests.at(i).title = TestIndex::get(paths.at(i)).title;
+        }
+    }
+
+    return tests;
+}
+
+// Opens the results database, importing the CSV when it's a new one.
+static QSharedPointer<ResultsStore> openStore(const QString &path, const QString &testsPath)
+{
+    auto store = QSharedPointer<ResultsStore>::create(path);
+    if (store->isEmpty()) {
+        store->replace(parseResults(path, testsPath));
+    }
+
+    return store;
+}
+
+Tests Tests::load(const TestSuite testSuite, const QString &path, const QString &testsPath)
+{
+    const auto store = openStore(path, testsPath);
+    return loadStore(*store, testsPath, testSuite == TestSuite::Own);
+}
+
 Tests Tests::loadCustom(const QString &path)
 {
     // Tests tests;
@@ -198,68 +226,278 @@ Tests Tests::loadCustom(const QString &path)
         tests.m_data << item;
     }
 
+    // Renders only need sizes, but it's cheaper to index all tests at once.
+    TestIndex::update(paths);
+
     return tests;
 }
 
-void Tests::save(const QString &path)
+namespace {
+
+// A listing of a tests directory from the previous resync.
+struct IndexEntry
 {
-    QString text = "title,batik,jsvg,svgsalamander,echosvg\n";
-    for (const TestItem &item : m_data) {
-        text += item.baseName + ',';
-        text += QString::number((int)item.state.value(Backend::Batik))      + ',';
-        text += QString::number((int)item.state.value(Backend::JSVG))       + ',';
-        text += QString::number((int)item.state.value(Backend::SVGSalamander))  + ',';
-        text += QString::number((int)item.state.value(Backend::EchoSVG)) + '\n';
-    }
+    QString name;
+    bool isDir;
+    qint64 mtime; // Files only.
+    QByteArray hash; // Files only. Used to detect renames.
+};
+
+struct DirIndex
+{
+    qint64 mtime;
+    QVector<IndexEntry> entries;
+};
+
+QDataStream& operator<<(QDataStream &s, const IndexEntry &e)
+{
+    return s << e.name << e.isDir << e.mtime << e.hash;
+}
+
+QDataStream& operator>>(QDataStream &s, IndexEntry &e)
+{
+    return s >> e.name >> e.isDir >> e.mtime >> e.hash;
+}
+
+QDataStream& operator<<(QDataStream &s, const DirIndex &d)
+{
+    return s << d.mtime << d.entries;
+}
+
+QDataStream& operator>>(QDataStream &s, DirIndex &d)
+{
+    return s >> d.mtime >> d.entries;
+}
+
+typedef QHash<QString, DirIndex> ResyncIndex; // Directory path -> listing.
+
+struct ScannedFile
+{
+    QString path;
+    QByteArray hash;
+};
+
+}
+
+static const quint32 IndexMagic = 0x76646978; // vdix
+static const quint32 IndexVersion = 1;
+
+// Directory mtime can have a 1-2s resolution, so a directory modified right before
+// the index was saved could look unchanged.
+static const qint64 MtimeResolution = 2000; // ms
+
+static QString indexPath(const QString &testsPath)
+{
+    const auto id = QCryptographicHash::hash(testsPath.toUtf8(), QCryptographicHash::Md5).toHex();
+    return Paths::workDir() + "/resync-" + id + ".index";
+}
+
+static ResyncIndex loadIndex(const QString &path, qint64 *indexedAt)
+{
+    *indexedAt = 0;
 
     QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return ResyncIndex();
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion) {
+        return ResyncIndex();
+    }
+
+    ResyncIndex index;
+    stream >> *indexedAt >> index;
+    if (stream.status() != QDataStream::Ok) {
+        *indexedAt = 0;
+        return ResyncIndex();
+    }
+
+    return index;
+}
+
+static void saveIndex(const QString &path, const ResyncIndex &index, const qint64 indexedAt)
+{
+    QSaveFile file(path);
     if (!file.open(QFile::WriteOnly)) {
-        throw QString("Failed to open %1.").arg(path);
+        qWarning() << "Failed to write" << path;
+        return;
     }
 
-    file.write(text.toUtf8());
+    QDataStream stream(&file);
+    stream << IndexMagic << IndexVersion << indexedAt << index;
+    file.commit();
+}
+
+// Reuses the hash of an unchanged file. Files are rehashed within the mtime resolution
+// of the previous resync, like directories are relisted.
+static IndexEntry fileEntry(const QFileInfo &fi, const IndexEntry &prev, const qint64 trustedBefore)
+{
+    const qint64 mtime = fi.lastModified().toMSecsSinceEpoch();
+    const bool isSame = prev.mtime == mtime && mtime < trustedBefore && !prev.hash.isEmpty();
+    const auto hash = isSame ? prev.hash : Paths::fileHash(fi.absoluteFilePath());
+    return { fi.fileName(), false, mtime, hash };
 }
 
-static void collectFilesRecursive(const QString &dir, QVector<QFileInfo> &files)
+// Collects SVG files in the same order as a full recursive listing sorted by name.
+//
+// Adding, removing or renaming an entry updates the mtime of its directory,
+// so directories with the same mtime as during the previous resync are not listed again.
+// Their subdirectories are still checked, and so are their files, since an in-place edit
+// doesn't update the directory.
+static void scanDir(const QString &dir, const ResyncIndex &oldIndex, const qint64 trustedBefore,
+                    ResyncIndex &newIndex, QVector<ScannedFile> &files, int *listedDirs)
 {
-    const auto infos = QDir(dir).entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot, QDir::Name);
-    for (const QFileInfo &fi : infos) {
-        if (fi.isDir()) {
-            collectFilesRecursive(fi.absoluteFilePath(), files);
-        } else if (fi.suffix() == "svg") {
-            files << fi;
+    const qint64 mtime = QFileInfo(dir).lastModified().toMSecsSinceEpoch();
+
+    const auto old = oldIndex.constFind(dir);
+    const bool hasOld = old != oldIndex.constEnd();
+
+    DirIndex index;
+    if (hasOld && old->mtime == mtime && mtime < trustedBefore) {
+        index.mtime = mtime;
+        for (const auto &entry : old->entries) {
+            if (entry.isDir) {
+                index.entries.append(entry);
+            } else {
+                const QFileInfo fi(dir + '/' + entry.name);
+                index.entries.append(fileEntry(fi, entry, trustedBefore));
+            }
+        }
+    } else {
+        (*listedDirs)++;
+
+        QHash<QString, IndexEntry> oldEntries;
+        if (hasOld) {
+            for (const auto &entry : old->entries) {
+                oldEntries.insert(entry.name, entry);
+            }
+        }
+
+        index.mtime = mtime;
+
+        const auto infos = QDir(dir).entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot,
+                                                   QDir::Name);
+        for (const QFileInfo &fi : infos) {
+            if (fi.isDir()) {
+                index.entries.append({ fi.fileName(), true, 0, QByteArray() });
+            } else if (fi.suffix() == "svg") {
+                index.entries.append(fileEntry(fi, oldEntries.value(fi.fileName()),
+                                               trustedBefore));
+            }
+        }
+    }
+
+    newIndex.insert(dir, index);
+
+    for (const auto &entry : index.entries) {
+        const QString path = dir + '/' + entry.name;
+        if (entry.isDir) {
+            scanDir(path, oldIndex, trustedBefore, newIndex, files, listedDirs);
+        } else {
+            files.append({ path, entry.hash });
         }
     }
 }
 
-void Tests::resync(const Settings &settings)
+Tests::SyncReport Tests::resync(const Settings &settings)
 {
-    QVector<QFileInfo> files;
-    collectFilesRecursive(settings.testsPath(), files);
+    const QString testsPath = QDir::cleanPath(QFileInfo(settings.testsPath()).absoluteFilePath());
+    const QString idxPath = indexPath(testsPath);
 
-    auto oldTests = load(settings.testSuite, settings.resultsPath(), settings.testsPath());
-    Tests newTests;
+    qint64 indexedAt = 0;
+    const auto oldIndex = loadIndex(idxPath, &indexedAt);
+    const qint64 scanStarted = QDateTime::currentMSecsSinceEpoch();
 
-    for (const QFileInfo &fi : files) {
-        const auto baseName = resolveBaseName(fi);
+    SyncReport report;
+
+    ResyncIndex newIndex;
+    QVector<ScannedFile> files;
+    scanDir(testsPath, oldIndex, indexedAt - MtimeResolution, newIndex, files,
+            &report.listedDirs);
 
-        bool isExists = false;
-        for (const TestItem &test : oldTests) {
-            if (test.baseName == baseName) {
-                isExists = true;
-                newTests.m_data << test;
-                break;
+    const auto store = openStore(settings.resultsPath(), testsPath);
+    const auto oldTests = loadStore(*store, testsPath, false);
+
+    QHash<QString, int> oldByName;
+    for (int i = 0; i < oldTests.size(); ++i) {
+        oldByName.insert(oldTests.at(i).baseName, i);
+    }
+
+    // Hashes of the files that are gone, to find out where they were moved to.
+    QSet<QString> scannedPaths;
+    for (const auto &file : files) {
+        scannedPaths.insert(file.path);
+    }
+
+    QMultiHash<QByteArray, QString> goneByHash;
+    for (auto it = oldIndex.constBegin(); it != oldIndex.constEnd(); ++it) {
+        for (const auto &entry : it.value().entries) {
+            const QString path = it.key() + '/' + entry.name;
+            if (!entry.isDir && !entry.hash.isEmpty() && !scannedPaths.contains(path)) {
+                goneByHash.insert(entry.hash, resolveBaseName(QFileInfo(path)));
             }
         }
+    }
+
+    // Duplicate files are common, so a rename is only detected when a single file
+    // with that content is gone and a single one is added.
+    QHash<QByteArray, int> addedByHash;
+    for (const auto &file : files) {
+        if (!oldByName.contains(resolveBaseName(QFileInfo(file.path)))) {
+            addedByHash[file.hash]++;
+        }
+    }
+
+    Tests newTests;
+    QSet<int> usedTests;
+    for (const auto &file : files) {
+        const QFileInfo fi(file.path);
+        const auto baseName = resolveBaseName(fi);
 
-        if (!isExists) {
-            TestItem item;
-            item.path = fi.absoluteFilePath();
-            item.baseName = baseName;
-            newTests.m_data << item;
+        const auto idx = oldByName.constFind(baseName);
+        if (idx != oldByName.constEnd()) {
+            usedTests.insert(idx.value());
+            newTests.append(oldTests.at(idx.value()));
+            continue;
         }
+
+        TestItem item;
+        item.path = fi.absoluteFilePath();
+        item.baseName = baseName;
+
+        const bool isUnique =    !file.hash.isEmpty()
+                              && goneByHash.count(file.hash) == 1
+                              && addedByHash.value(file.hash) == 1;
+        const auto oldName = isUnique ? goneByHash.value(file.hash) : QString();
+        const auto renamed = oldByName.constFind(oldName);
+        if (!oldName.isEmpty() && renamed != oldByName.constEnd()
+            && !usedTests.contains(renamed.value()))
+        {
+            usedTests.insert(renamed.value());
+            item.state = oldTests.at(renamed.value()).state;
+            report.renamed.append({ oldName, baseName });
+        } else {
+            report.added << baseName;
+        }
+
+        newTests.append(item);
     }
-    newTests.save(settings.resultsPath());
+
+    for (int i = 0; i < oldTests.size(); ++i) {
+        if (!usedTests.contains(i)) {
+            report.removed << oldTests.at(i).baseName;
+        }
+    }
+
+    store->replace(newTests);
+    store->exportCsv();
+    saveIndex(idxPath, newIndex, scanStarted);
+
+    return report;
 }
 
 static QString testSuiteToString(const TestSuite &t)
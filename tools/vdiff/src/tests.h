@@ -2,6 +2,8 @@
 
 #include <QVector>
 #include <QHash>
+#include <QPair>
+#include <QStringList>
 
 class Settings;
 
@@ -49,11 +51,20 @@ struct TestItem
 class Tests
 {
 public:
+    struct SyncReport
+    {
+        QStringList added;
+        QStringList removed;
+        QVector<QPair<QString, QString>> renamed; // Old and new base name.
+        int listedDirs = 0; // Directories that were changed since the previous resync.
+    };
+
     static Tests load(const TestSuite testSuite, const QString &path, const QString &testsPath);
     static Tests loadCustom(const QString &path);
-    void save(const QString &path);
 
-    static void resync(const Settings &settings);
+    // Updates the results file to match the tests directory.
+    // States of renamed tests are preserved, when the content is the same.
+    static SyncReport resync(const Settings &settings);
 
     QVector<TestItem>::const_iterator begin() const { return m_data.begin(); }
     QVector<TestItem>::const_iterator end() const { return m_data.end(); }
@@ -62,6 +73,7 @@ public:
     const TestItem& at(int row) const { return m_data.at(row); }
 
     int size() const { return m_data.size(); }
+    void append(const TestItem &item) { m_data << item; }
 
 private:
     QVector<TestItem> m_data;
@@ -0,0 +1,18 @@
+QT = core gui
+
+TARGET = diffkernel-test
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# Checks that the SIMD kernels match the scalar one bit-for-bit.
+VDIFF = $$PWD/../..
+
+INCLUDEPATH += $$VDIFF/src
+
+SOURCES += \
+    main.cpp \
+    $$VDIFF/src/diffkernel.cpp
+
+HEADERS += \
+    $$VDIFF/src/diffkernel.h
@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "diffkernel.h"
+
+namespace {
+
+struct Output
+{
+    std::vector<QRgb> mask;
+    int count = 0;
+    int minX = -1;
+    int maxX = -1;
+};
+
+const char* const Kernels[] = { "sse2", "avx2" };
+
+}
+
+static bool run(const char *kernel, const std::vector<QRgb> &row1, const std::vector<QRgb> &row2,
+                const int maxDistance2, Output *out)
+{
+    const int width = int(row1.size());
+    out->mask.assign(width + 1, 0); // One extra pixel to catch writes past the end.
+    out->count = DiffKernel::compareRowWith(kernel, row1.data(), row2.data(), out->mask.data(),
+                                            width, maxDistance2, &out->minX, &out->maxX);
+    return out->count != -1;
+}
+
+// Returns the number of failures.
+static int check(const char *test, const std::vector<QRgb> &row1, const std::vector<QRgb> &row2,
+                 const int maxDistance2)
+{
+    Output expected;
+    run("scalar", row1, row2, maxDistance2, &expected);
+
+    int failures = 0;
+    for (const auto kernel : Kernels) {
+        Output actual;
+        if (!run(kernel, row1, row2, maxDistance2, &actual)) {
+            continue;
+        }
+
+        const bool isSame =    actual.mask == expected.mask
+                            && actual.count == expected.count
+                            && actual.minX == expected.minX
+                            && actual.maxX == expected.maxX;
+        if (!isSame) {
+            printf("FAIL: %s, %s, width %d: count %d/%d, minX %d/%d, maxX %d/%d\n",
+                   test, kernel, int(row1.size()), actual.count, expected.count,
+                   actual.minX, expected.minX, actual.maxX, expected.maxX);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+int main()
+{
+    for (const auto kernel : Kernels) {
+        const QRgb px = 0;
+        int minX = 0;
+        int maxX = 0;
+        QRgb out = 0;
+        const bool isSupported = DiffKernel::compareRowWith(kernel, &px, &px, &out, 1, 0,
+                                                            &minX, &maxX) != -1;
+        printf("%s: %s\n", kernel, isSupported ? "tested" : "not supported, skipped");
+    }
+
+    std::mt19937 rng(42);
+    const auto randomPixel = [&rng]() { return QRgb(rng()); };
+
+    int failures = 0;
+
+    // Widths that are not a multiple of 4 or 8 test the tail handling.
+    std::vector<int> widths;
+    for (int w = 0; w <= 40; ++w) {
+        widths.push_back(w);
+    }
+    widths.push_back(1000);
+    widths.push_back(1003);
+
+    for (const int width : widths) {
+        for (int i = 0; i < 20; ++i) {
+            std::vector<QRgb> row1(width);
+            std::vector<QRgb> row2(width);
+            for (int x = 0; x < width; ++x) {
+                row1[x] = randomPixel();
+
+                // Mostly close pixels, so both results are common.
+                const int d = int(rng() % 8);
+                row2[x] = qRgba(qBound(0, qRed(row1[x]) + d, 255),
+                                qBound(0, qGreen(row1[x]) - d, 255),
+                                qBound(0, qBlue(row1[x]) + d / 2, 255),
+                                int(rng() % 256));
+                if (rng() % 4 == 0) {
+                    row2[x] = randomPixel();
+                }
+            }
+
+            failures += check("random", row1, row2, int(rng() % 200));
+            failures += check("random, same", row1, row1, 0);
+        }
+    }
+
+    // Squared distances of exactly 35 and 36 around the default threshold of 35,
+    // placed at every position of a row, including the tail.
+    for (const int width : { 7, 8, 9, 15, 16, 17, 33 }) {
+        for (int pos = 0; pos < width; ++pos) {
+            std::vector<QRgb> row1(width, qRgb(100, 100, 100));
+            std::vector<QRgb> row2 = row1;
+
+            row2[pos] = qRgb(105, 103, 101); // 25 + 9 + 1 = 35
+            failures += check("distance 35", row1, row2, 35);
+
+            row2[pos] = qRgb(94, 100, 100); // 36
+            failures += check("distance 36", row1, row2, 35);
+        }
+    }
+
+    if (failures != 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
@@ -1,4 +1,4 @@
-QT      += core gui widgets concurrent sql
+QT      += core gui widgets concurrent network sql
 
 TARGET   = vdiff
 TEMPLATE = app
@@ -6,7 +6,10 @@ TEMPLATE = app
 CONFIG += c++11
 
 SOURCES  += \
+    src/batch.cpp \
+    src/diffkernel.cpp \
     src/exportdialog.cpp \
+    src/imagepool.cpp \
     src/imageview.cpp \
     src/main.cpp \
     src/mainwindow.cpp \
@@ -16,10 +19,23 @@ SOURCES  += \
     src/tests.cpp \
     src/paths.cpp \
     src/settings.cpp \
-    src/backendwidget.cpp
+    src/sheet.cpp \
+    src/backendwidget.cpp \
+    src/rendercache.cpp \
+    src/renderhistory.cpp \
+    src/renderserver.cpp \
+    src/scheduler.cpp \
+    src/jobstats.cpp \
+    src/resultsstore.cpp \
+    src/classifier.cpp \
+    src/referencestore.cpp \
+    src/testindex.cpp
 
 HEADERS  += \
+    src/batch.h \
+    src/diffkernel.h \
     src/exportdialog.h \
+    src/imagepool.h \
     src/imageview.h \
     src/mainwindow.h \
     src/process.h \
@@ -28,7 +44,17 @@ HEADERS  += \
     src/tests.h \
     src/paths.h \
     src/settings.h \
-    src/backendwidget.h
+    src/sheet.h \
+    src/backendwidget.h \
+    src/rendercache.h \
+    src/renderhistory.h \
+    src/renderserver.h \
+    src/scheduler.h \
+    src/jobstats.h \
+    src/resultsstore.h \
+    src/classifier.h \
+    src/referencestore.h \
+    src/testindex.h
 
 FORMS    += \
     src/exportdialog.ui \